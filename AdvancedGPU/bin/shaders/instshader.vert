@@ -0,0 +1,41 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inSize;
+layout(location = 2) in vec4 inUVRect;
+layout(location = 3) in vec4 inColor;
+layout(location = 4) in float inRotation;
+
+layout(location = 0) out vec2 outUV;
+layout(location = 1) out vec4 outColor;
+
+layout(set = 1, binding = 0) uniform UniformBufferObject
+{
+    layout(row_major) mat4 projection;
+} ubo;
+
+void main()
+{
+    // Drawn with the shared 0,1,2,2,3,0 quad indices, so the vertex
+    // index picks one of the four corners
+    vec2 corners[4] = vec2[](
+        vec2(0, 0),
+        vec2(1, 0),
+        vec2(1, 1),
+        vec2(0, 1)
+    );
+
+    vec2 corner = corners[gl_VertexIndex];
+
+    // Rotate around the centre of the sprite
+    vec2 local = (corner - 0.5) * inSize;
+    float c = cos(inRotation);
+    float s = sin(inRotation);
+    vec2 rotated = vec2(local.x * c - local.y * s,
+                        local.x * s + local.y * c);
+    vec2 position = inPosition + 0.5 * inSize + rotated;
+
+    gl_Position = ubo.projection * vec4(position, 0.0, 1.0);
+    outUV = mix(inUVRect.xy, inUVRect.zw, corner);
+    outColor = inColor;
+}
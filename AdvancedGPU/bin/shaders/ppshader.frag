@@ -8,6 +8,8 @@ layout(set = 3, binding = 0) uniform UniformBufferObject
     float speed;
     float frequency;
     float amplitude;
+    vec2 uvScale; // part of the scene texture that was rendered to
+    vec2 padding;
 } ubo;
 
 layout(set = 2, binding = 0) uniform sampler2D texSampler;
@@ -34,5 +36,10 @@ void main()
     vec2 q = shift(r + 1.0);
     vec2 s = r + ubo.amplitude * (p - q);
 
+    // Stay half a texel inside the rendered area so filtering never
+    // picks up the unused part of the texture
+    vec2 halfTexel = 0.5 / vec2(textureSize(texSampler, 0));
+    s = clamp(s * ubo.uvScale, halfTexel, ubo.uvScale - halfTexel);
+
     outColor = texture(texSampler, s);
 }
\ No newline at end of file
@@ -9,4 +9,7 @@ pushd bin
 
 cl -FC -EHsc -MT -nologo -Z7 %sdli% ../main.c -link %sdll% -SUBSYSTEM:WINDOWS SDL3.lib
 
+REM Offline shader packer, see README.md
+cl -FC -MT -nologo -Z7 ../tools/shaderpack.c
+
 popd
\ No newline at end of file
@@ -1,471 +1,5792 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include <assert.h>
+#include <stddef.h>
+
+// Matches SDL's default for SDL_SetGPUAllowedFramesInFlight
+#define DEFAULT_FRAMES_IN_FLIGHT 2
 
 typedef struct
 {
     SDL_GPUBuffer *vertex;
     SDL_GPUBuffer *index;
     SDL_GPUTransferBuffer *transfer;
+    Uint32 maxSizeVertex;
     Uint32 indexCount;
     
+    // The index buffer is static and shared by every quad
+    Uint32 maxQuadCount;
+    SDL_GPUIndexElementSize indexElementSize;
+    
+    // The transfer buffer is a ring with one slice per frame in flight
+    Uint32 frameCount;
+    Uint32 frameSize;
+    
 } RenderBuffers;
 
 typedef struct
 {
-	char *basePath;
-	SDL_Window* window;
-	SDL_GPUDevice* device;
-	float deltaTime;
-    float time;
-    
-    Uint32 winWidth;
-    Uint32 winHeight;
-    
-    SDL_GPUSampler *samplerPoint;
-    SDL_GPUTexture *texture;
-    SDL_GPUTransferBuffer *transferBufferTexture;
-    
-    // Dynamic rendering
-    RenderBuffers buffersDynamic;
-    SDL_GPUGraphicsPipeline* pipelineDynamic;
+    float x, y;
+    float u, v;
+    float r, g, b, a;
     
-    // Post-process
-    SDL_GPUGraphicsPipeline* pipelinePostProcess;
-    SDL_GPUTexture *texturePostProcess;
+} Vertex;
+
+// Half the size of Vertex, UVs are UNORM16 and the colour is UBYTE4_NORM
+typedef struct
+{
+    float x, y;
+    Uint16 u, v;
+    Uint8 r, g, b, a;
     
-} Context;
+} PackedVertex;
+
+SDL_COMPILE_TIME_ASSERT(PackedVertex, sizeof(PackedVertex) == 16);
 
+// One record per sprite, the vertex shader builds the corners
 typedef struct
 {
     float x, y;
-    float u, v;
-    float r, g, b, a;
+    float w, h;
+    Uint16 u0, v0, u1, v1;
+    Uint8 r, g, b, a;
+    float rotation;
     
-} Vertex;
+} SpriteInstance;
 
-SDL_GPUShader*
-shader_load(Context* context,
-            char* shaderFilename,
-            SDL_GPUShaderStage stage,
-            Uint32 samplerCount,
-            Uint32 uniformCount)
+SDL_COMPILE_TIME_ASSERT(SpriteInstance, sizeof(SpriteInstance) == 32);
+
+// A sprite before it is expanded into the batch's vertex format
+typedef struct
 {
-    // Construct a full path with basePath and shaderFilename
-	char fullPath[512] = {0};
-    SDL_strlcat(fullPath, context->basePath, sizeof(fullPath));
-    SDL_strlcat(fullPath, shaderFilename, sizeof(fullPath));
+    float x, y, w, h;
+    float u0, v0, u1, v1;
+    SDL_FColor color;
+    float rotation;
     
-    // Load the SPIR-V "code" (these must have been compiled already)
-	size_t codeSize;
-	void* code = SDL_LoadFile(fullPath, &codeSize);
-	assert(code);
+} Sprite;
+
+typedef enum
+{
+    VERTEX_FORMAT_FLOAT,
+    VERTEX_FORMAT_PACKED,
+    VERTEX_FORMAT_INSTANCE,
     
-    // Create the shader
-    SDL_GPUShaderCreateInfo shaderInfo =
-    {
-        codeSize,
-        code,
-        "main",
-        SDL_GPU_SHADERFORMAT_SPIRV,
-        stage,
-        samplerCount,
-        0, // storage textures
-        0, // storage buffers
-        uniformCount // uniform buffers
-    };
+} VertexFormat;
+
+typedef enum
+{
+    SAMPLER_POINT,
+    SAMPLER_LINEAR,
+    SAMPLER_TRILINEAR,
+    SAMPLER_ANISOTROPIC,
     
-    SDL_GPUShader* shader = SDL_CreateGPUShader(context->device, &shaderInfo);
-    assert(shader);
+    SAMPLER_COUNT
     
-    // Free the code memory and return the shader
-    SDL_free(code);
-    return shader;
-}
+} SamplerType;
 
-SDL_GPUGraphicsPipeline *
-create_pipeline(Context *context,
-                SDL_GPUShader *shaderVertex,
-                SDL_GPUShader *shaderFragment,
-                SDL_GPUVertexBufferDescription vertexBufferDescArray[],
-                Uint32 vertexBufferDescCount,
-                SDL_GPUVertexAttribute vertexAttribArray[],
-                Uint32 vertexAttribCount)
+// A run of quads in a batch that share the same pipeline, texture and sampler
+typedef struct
 {
-    SDL_GPUGraphicsPipeline *result = 0;
+    SDL_GPUGraphicsPipeline *pipeline;
+    SDL_GPUTexture *texture;
+    SamplerType sampler;
+    Uint32 firstIndex;
+    Uint32 indexCount;
     
-    SDL_GPURasterizerState rasterizerState = { SDL_GPU_FILLMODE_FILL };
+    // Instanced draws read one record per quad instead, 0 when indexed
+    Uint32 instanceStride;
+    Uint32 firstInstance;
+    Uint32 instanceCount;
     
-    // The vertex input state (buffrs and layouts)
-    SDL_GPUVertexInputState vertexInputState =
-    {
-        vertexBufferDescArray,
-        vertexBufferDescCount,
-        vertexAttribArray,
-        vertexAttribCount
-    };
+    // Draw arguments written on the GPU, overrides the counts above
+    SDL_GPUBuffer *indirect;
     
-    SDL_GPUMultisampleState multisampleState = {0};
-    SDL_GPUDepthStencilState depthStencilState = {0};
+} BatchDraw;
+
+#define MAX_BATCH_DRAWS 256
+
+// A color target with the load and store ops a render pass should use
+typedef struct
+{
+    SDL_GPUTexture *texture;
+    SDL_GPULoadOp loadOp;
+    SDL_GPUStoreOp storeOp;
+    SDL_FColor clearColor;
     
-    // The color target array
-    SDL_GPUColorTargetDescription colorTargetDescArray[] =
-    {
-        { SDL_GetGPUSwapchainTextureFormat(context->device, context->window) }
-    };
+    // Safe whenever the old contents aren't loaded
+    bool cycle;
     
-    // The target config (color targets, etc)
-    SDL_GPUGraphicsPipelineTargetInfo targetInfo =
-    {
-        .color_target_descriptions = colorTargetDescArray,
-        .num_color_targets = SDL_arraysize(colorTargetDescArray),
-    };
+    // Drawing is limited to the top left of the target, 0 for all of it
+    Uint32 viewportWidth;
+    Uint32 viewportHeight;
     
-    // The pipeline config
-    SDL_GPUGraphicsPipelineCreateInfo pipelineCreateInfo =
-    {
-		shaderVertex,
-		shaderFragment,
-        vertexInputState,
-		SDL_GPU_PRIMITIVETYPE_TRIANGLELIST,
-        rasterizerState,
-        multisampleState,
-        depthStencilState,
-        targetInfo
-    };
+} RenderTarget;
+
+// A run of sprites written to consecutive quads by the job system
+typedef struct
+{
+    VertexFormat format;
+    Uint8 *vertices;
+    const Sprite *sprites;
     
-    result =
-        SDL_CreateGPUGraphicsPipeline(context->device,
-                                      &pipelineCreateInfo);
-    if (!context->pipelineDynamic)
-    {
-        const char *error = SDL_GetError();
-        SDL_Log(error);
-    }
+} SpriteExpansion;
+
+#define MAX_BATCH_EXPANSIONS 64
+
+// Sprites per job, shorter runs are written on the calling thread
+#define SPRITE_JOB_GRAIN 1024
+
+typedef struct
+{
+    RenderBuffers *buffers;
+    Uint32 maxQuadCount;
     
-    assert(result);
+    // Vertex layout written to the buffers and the pipeline that reads it
+    VertexFormat format;
+    Uint32 quadSize;
+    SDL_GPUGraphicsPipeline *defaultPipeline;
     
-    // Clean up shader resources
-    SDL_ReleaseGPUShader(context->device, shaderVertex);
-    SDL_ReleaseGPUShader(context->device, shaderFragment);
+    // Where the batch is rendered to, valid between begin and end. The
+    // first pass uses the target's load op, later ones load what it drew.
+    SDL_GPUCommandBuffer *cmdbuf;
+    RenderTarget target;
+    float matrix[16];
+    bool targetStarted;
+    bool ending;
     
-    return result;
-}
+    // Mapped transfer buffer memory, 0 when not mapped
+    Uint8 *vertices;
+    Uint32 transferOffset;
+    Uint32 quadCount;
+    
+    // Runs still being written by the job system, all of them finish
+    // before the transfer buffer is unmapped
+    SpriteExpansion expansions[MAX_BATCH_EXPANSIONS];
+    Uint32 expansionCount;
+    SDL_AtomicInt pendingJobs;
+    
+    // Current state, changing it starts a new draw
+    SDL_GPUGraphicsPipeline *pipeline;
+    SDL_GPUTexture *texture;
+    SamplerType sampler;
+    
+    BatchDraw draws[MAX_BATCH_DRAWS];
+    Uint32 drawCount;
+    
+    // Stats for the last frame
+    Uint32 quadsPushed;
+    Uint32 flushCount;
+    Uint32 drawCallCount;
+    
+} SpriteBatch;
 
-void
-create_pipeline_dynamic(Context *context)
+// Sprites that are culled on the GPU and drawn with an indirect draw
+typedef struct
 {
-    // Create the shaders
-	SDL_GPUShader* shaderVertex = shader_load(context,
-                                              "shaders/vert.spv",
-                                              SDL_GPU_SHADERSTAGE_VERTEX,
-                                              0, // sampler count
-                                              1); // uniform count
+    // All SpriteInstance records, read by the cull compute shader
+    SDL_GPUBuffer *sprites;
+    SDL_GPUTransferBuffer *transfer;
+    Uint32 maxSpriteCount;
+    Uint32 spriteCount;
     
-	SDL_GPUShader* shaderFragment = shader_load(context,
-                                                "shaders/frag.spv",
-                                                SDL_GPU_SHADERSTAGE_FRAGMENT,
-                                                1, // sampler count
-                                                0); // uniform count
+    // Survivors compacted into an instance buffer, drawn with the
+    // shared quad indices
+    RenderBuffers visible;
     
-    SDL_GPUVertexBufferDescription vertexBufferDescArray[] =
-    {
-        { 0, sizeof(Vertex), SDL_GPU_VERTEXINPUTRATE_VERTEX, 0 }
-    };
+    // One SDL_GPUIndexedIndirectDrawCommand, reset from a copy every frame
+    SDL_GPUBuffer *indirect;
+    SDL_GPUBuffer *indirectReset;
     
-    SDL_GPUVertexAttribute vertexAttribArray[] =
-    {
-        { 0, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2, 0 },
-        { 1, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2, sizeof(float) * 2 },
-        { 2, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT4, sizeof(float) * 4 }
-    };
+} CullBuffers;
+
+// Matches the uniform block in cull.comp
+typedef struct
+{
+    float matrix[16];
+    Uint32 spriteCount;
+    Uint32 padding[3];
     
-    context->pipelineDynamic =
-        create_pipeline(context,
-                        shaderVertex,
-                        shaderFragment,
-                        vertexBufferDescArray,
-                        SDL_arraysize(vertexBufferDescArray),
-                        vertexAttribArray,
-                        SDL_arraysize(vertexAttribArray));
-}
+} CullUniforms;
 
-void
-create_pipeline_postprocess(Context *context)
+#define CULL_THREAD_COUNT 64
+
+// A copy from a transfer buffer that is recorded with the next frame
+typedef struct
 {
-    // Create the shaders
-	SDL_GPUShader* shaderVertex = shader_load(context,
-                                              "shaders/ppvert.spv",
-                                              SDL_GPU_SHADERSTAGE_VERTEX,
-                                              0, // sampler count
-                                              0); // uniform count
+    SDL_GPUTransferBuffer *transfer;
+    Uint32 transferOffset;
+    
+    // Either a buffer or a texture destination
+    SDL_GPUBuffer *buffer;
+    Uint32 bufferOffset;
+    Uint32 size;
     
-	SDL_GPUShader* shaderFragment = shader_load(context,
-                                                "shaders/ppfrag.spv",
-                                                SDL_GPU_SHADERSTAGE_FRAGMENT,
-                                                1, // sampler count
-                                                1); // uniform count
+    SDL_GPUTexture *texture;
+    Uint32 x;
+    Uint32 y;
+    Uint32 width;
+    Uint32 height;
     
-    SDL_GPUVertexBufferDescription vertexBufferDescArray[] = { 0 };
-    SDL_GPUVertexAttribute vertexAttribArray[] = { 0 };
+    // Copies from another texture instead of the transfer buffer
+    SDL_GPUTexture *sourceTexture;
+    Uint32 sourceX;
+    Uint32 sourceY;
     
-    context->pipelinePostProcess =
-        create_pipeline(context,
-                        shaderVertex,
-                        shaderFragment,
-                        vertexBufferDescArray,
-                        SDL_arraysize(vertexBufferDescArray),
-                        vertexAttribArray,
-                        SDL_arraysize(vertexAttribArray));
-}
+    // Set when the whole destination is replaced
+    bool cycle;
+    
+} PendingUpload;
 
-void
-release_buffers(Context *context,
-                RenderBuffers *buffers)
-{
-    SDL_ReleaseGPUBuffer(context->device, buffers->vertex);
-    SDL_ReleaseGPUBuffer(context->device, buffers->index);
-    SDL_ReleaseGPUTransferBuffer(context->device, buffers->transfer);
-}
+#define MAX_PENDING_MIPMAPS 64
 
-RenderBuffers
-create_buffers(Context *context,
-               Uint32 maxSizeVertex,
-               Uint32 maxSizeIndex)
+typedef struct
 {
-    RenderBuffers result = {0};
+    PendingUpload *uploads;
+    Uint32 count;
+    Uint32 capacity;
     
-    // Create vertex buffer
-    result.vertex = SDL_CreateGPUBuffer(context->device,
-                                        &(SDL_GPUBufferCreateInfo)
-                                        {
-                                            SDL_GPU_BUFFERUSAGE_VERTEX,
-                                            maxSizeVertex,
-                                            0
-                                        });
+    // Resources that queued copies still use, released after the flush
+    SDL_GPUTexture **retiredTextures;
+    Uint32 retiredTextureCount;
+    Uint32 retiredTextureCapacity;
+    SDL_GPUTransferBuffer **retiredTransfers;
+    Uint32 retiredTransferCount;
+    Uint32 retiredTransferCapacity;
     
-    // Create index buffer
-    result.index = SDL_CreateGPUBuffer(context->device,
-                                       &(SDL_GPUBufferCreateInfo)
-                                       {
-                                           SDL_GPU_BUFFERUSAGE_INDEX,
-                                           maxSizeIndex,
-                                           0
-                                       });
+    // Textures whose mip chain is rebuilt after the copy pass
+    SDL_GPUTexture *mipmapTextures[MAX_PENDING_MIPMAPS];
+    Uint32 mipmapTextureCount;
     
-    // Create transfer buffer for vertex data
-    result.transfer =
-        SDL_CreateGPUTransferBuffer(context->device,
-                                    &(SDL_GPUTransferBufferCreateInfo)
-                                    {
-                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-                                        maxSizeVertex + maxSizeIndex
-                                    });
+    // Number of flushes, anything written before a flush has been recorded
+    Uint64 flushCount;
     
-    return result;
-}
+} UploadQueue;
 
-void
-update_buffers(Context *context,
-               RenderBuffers *buffers,
-               void *dataVert, Uint32 dataSizeVert,
-               void *dataInd, Uint32 dataSizeInd)
+typedef struct
 {
-    void* destData = SDL_MapGPUTransferBuffer(context->device,
-                                              buffers->transfer,
-                                              false);
+    Uint32 x, y, width;
     
-    // copy vertex data to GPU
-    memcpy(destData,
-           dataVert,
-           dataSizeVert);
+} SkylineNode;
+
+// Bottom-left skyline packer, one node per horizontal segment
+typedef struct
+{
+    SkylineNode *nodes;
+    Uint32 nodeCount;
+    Uint32 maxNodeCount;
+    Uint32 width;
+    Uint32 height;
     
-    // copy index data to GPU
-    memcpy((Uint8 *)destData + dataSizeVert,
-           dataInd,
-           dataSizeInd);
+} Skyline;
+
+typedef struct
+{
+    Uint32 x, y, width, height;
+    float u0, v0, u1, v1;
+    bool used;
     
-    SDL_UnmapGPUTransferBuffer(context->device, buffers->transfer);
+} AtlasRegion;
+
+#define ATLAS_PADDING 1
+#define ATLAS_INVALID_REGION 0xFFFFFFFF
+
+typedef struct
+{
+    SDL_GPUTexture *texture;
+    Uint32 width;
+    Uint32 height;
     
-    // Start command buffer and begin copy pass
-    SDL_GPUCommandBuffer *cmdBuf = SDL_AcquireGPUCommandBuffer(context->device);
-    SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdBuf);
+    Skyline skyline;
+    AtlasRegion *regions;
+    Uint32 regionCount;
+    Uint32 maxRegionCount;
     
-    // Upload vertex data
-    SDL_UploadToGPUBuffer(copyPass,
-                          &(SDL_GPUTransferBufferLocation)
-                          {
-                              buffers->transfer,
-                              0 // offset
-                          },
-                          &(SDL_GPUBufferRegion)
-                          {
-                              buffers->vertex, 0, dataSizeVert
-                          },
-                          false);
+    // Area handed out by the packer and the part of it still in use,
+    // the difference is what compaction gets back
+    Uint32 packedArea;
+    Uint32 usedArea;
+    Uint32 compactCount;
     
-    // Upload index data
-    SDL_UploadToGPUBuffer(copyPass,
-                          &(SDL_GPUTransferBufferLocation)
-                          {
-                              buffers->transfer,
-                              dataSizeVert // offset
-                          },
-                          &(SDL_GPUBufferRegion)
-                          {
-                              buffers->index, 0, dataSizeInd
-                          },
-                          false);
+    // Staging for region uploads, refilled after every queue flush
+    SDL_GPUTransferBuffer *transfer;
+    Uint32 transferSize;
+    Uint32 transferUsed;
+    Uint64 transferFlushCount;
     
-    // End pass and submit command buffer
-    SDL_EndGPUCopyPass(copyPass);
-    SDL_SubmitGPUCommandBuffer(cmdBuf);
+} TextureAtlas;
+
+typedef enum
+{
+    STREAM_QUEUED,
+    STREAM_STAGED,
+    STREAM_RESIDENT,
+    STREAM_FAILED,
     
-    buffers->indexCount = dataSizeInd / sizeof(Uint32);
-}
+} StreamState;
 
-void
-create_texture(Context *context, Uint32 width, Uint32 height)
+typedef struct
 {
-    context->texture = SDL_CreateGPUTexture(context->device,
-                                            &(SDL_GPUTextureCreateInfo)
-                                            {
-                                                SDL_GPU_TEXTURETYPE_2D,
-                                                SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM,
-                                                SDL_GPU_TEXTUREUSAGE_SAMPLER,
-                                                width,
-                                                height,
-                                                1, // layer count
-                                                1, // mip levels
-                                                SDL_GPU_SAMPLECOUNT_1
-                                            });
+    SDL_GPUTexture *texture;
+    Uint32 width;
+    Uint32 height;
+    Uint32 rowsUploaded;
+    StreamState state;
     
-    // Transfer buffer
-    context->transferBufferTexture =
-        SDL_CreateGPUTransferBuffer(context->device,
-                                    &(SDL_GPUTransferBufferCreateInfo)
-                                    {
-                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-                                        width * height * sizeof(Uint32)
-                                    });
-}
+} StreamedTexture;
 
-void
-update_texture(Context *context,
-               SDL_GPUTexture *texture,
-               SDL_GPUTransferBuffer *transfer,
-               Uint32 width, Uint32 height,
-               void *data)
+typedef struct
 {
-    // Map and copy texture data to GPU
-    Uint32* destData = SDL_MapGPUTransferBuffer(context->device,
-                                                transfer,
-                                                false);
-    memcpy(destData, data, width * height * sizeof(Uint32));
-    SDL_UnmapGPUTransferBuffer(context->device, transfer);
+    char path[512];
+    Uint32 handle;
     
-    // Start command buffer and begin copy pass
-    SDL_GPUCommandBuffer *cmdBuf = SDL_AcquireGPUCommandBuffer(context->device);
-    SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdBuf);
+} StreamRequest;
+
+// Decoded pixels waiting in the staging ring, kept in reservation order
+typedef struct
+{
+    Uint32 handle;
+    Uint64 start;
+    Uint64 end;
+    bool ready;
     
-    SDL_UploadToGPUTexture(copyPass,
-                           &(SDL_GPUTextureTransferInfo)
-                           {
-                               transfer,
-                               0,
-                               width,
-                               height
-                           },
-                           &(SDL_GPUTextureRegion)
-                           {
-                               texture,
-                               0, // mip level
-                               0, // layer
-                               0, // x
-                               0, // y
-                               0, // z
-                               width,
-                               height,
-                               1 // depth
-                           },
-                           false);
-    
-    // End pass and submit command buffer
-    SDL_EndGPUCopyPass(copyPass);
-    SDL_SubmitGPUCommandBuffer(cmdBuf);
-}
+} StreamStaged;
 
-void
-render_pass(Context *context,
-            SDL_GPUCommandBuffer* cmdbuf,
-            SDL_GPUGraphicsPipeline *pipeline,
-            SDL_GPUTexture *texture,
-            SDL_GPUTexture *target,
-            SDL_FColor clearColor,
-            RenderBuffers *buffers,
-            float matrix[],
-            float postProcessData[])
+#define MAX_STREAMED_TEXTURES 256
+#define MAX_STREAM_REQUESTS 256
+#define MAX_STREAM_STAGED 64
+#define MAX_STREAM_WORKERS 4
+#define STREAM_INVALID_HANDLE 0xFFFFFFFF
+
+typedef struct
 {
-    // Setup the color target as the swapchain image
-    SDL_GPUColorTargetInfo colorTargetInfo = { 0 };
-    colorTargetInfo.texture = target;
-    colorTargetInfo.clear_color = clearColor;
-    colorTargetInfo.load_op = SDL_GPU_LOADOP_CLEAR;
-    colorTargetInfo.store_op = SDL_GPU_STOREOP_STORE;
+    // Owned by the render thread, except for the state of failed loads
+    StreamedTexture textures[MAX_STREAMED_TEXTURES];
+    Uint32 textureCount;
+    
+    // Everything below is shared with the workers and guarded by the mutex
+    SDL_Mutex *mutex;
+    SDL_Condition *requestAvailable;
+    SDL_Condition *ringSpaceAvailable;
+    bool quit;
+    
+    StreamRequest requests[MAX_STREAM_REQUESTS];
+    Uint32 requestFirst;
+    Uint32 requestCount;
+    
+    // Positions only ever grow, the offset in the ring is position % size
+    Uint8 *ring;
+    Uint32 ringSize;
+    Uint64 ringHead;
+    Uint64 ringTail;
+    
+    StreamStaged staged[MAX_STREAM_STAGED];
+    Uint32 stagedFirst;
+    Uint32 stagedCount;
+    
+    SDL_Thread *workers[MAX_STREAM_WORKERS];
+    Uint32 workerCount;
+    
+    // Render thread side, at most this much is uploaded per frame
+    SDL_GPUTransferBuffer *transfer;
+    Uint32 bytesPerFrame;
+    Uint64 bytesUploaded;
+    
+} TextureStreamer;
+
+// Runs the items first to first + count - 1 of whatever data points at
+typedef void (*JobFunction)(void *data, Uint32 first, Uint32 count);
+
+typedef struct
+{
+    JobFunction function;
+    void *data;
+    Uint32 first;
+    Uint32 count;
+    
+    // Larger ranges are split in half before running
+    Uint32 grain;
+    
+    // Decremented once the range has run
+    SDL_AtomicInt *counter;
+    
+} Job;
+
+#define MAX_JOB_WORKERS 16
+#define JOB_QUEUE_SIZE 64
+
+// The owning thread pushes and pops at the bottom, other threads steal
+// from the top. Positions only ever grow, the slot is position % size.
+typedef struct
+{
+    SDL_SpinLock lock;
+    Job jobs[JOB_QUEUE_SIZE];
+    Uint32 top;
+    Uint32 bottom;
+    
+} JobQueue;
+
+typedef struct JobSystem JobSystem;
+
+typedef struct
+{
+    JobSystem *system;
+    Uint32 queueIndex;
+    SDL_Thread *thread;
+    
+} JobWorker;
+
+struct JobSystem
+{
+    // Queue 0 belongs to the thread that starts and waits for jobs, the
+    // rest to the workers
+    JobQueue queues[MAX_JOB_WORKERS + 1];
+    JobWorker workers[MAX_JOB_WORKERS];
+    Uint32 workerCount;
+    
+    // Workers with nothing to steal sleep on the semaphore
+    SDL_Semaphore *wake;
+    SDL_AtomicInt sleepingCount;
+    SDL_AtomicInt quit;
+    
+};
+
+typedef enum
+{
+    BLEND_NONE,
+    BLEND_ALPHA,
+    BLEND_ADDITIVE,
+    BLEND_PREMULTIPLIED,
+    
+} BlendMode;
+
+// Compiled shaders packed by tools/shaderpack.c, must match it
+#define SHADER_BUNDLE_MAGIC 0x4B504853 // "SHPK"
+#define SHADER_BUNDLE_VERSION 1
+#define SHADER_BUNDLE_NAME_SIZE 32
+#define SHADER_BUNDLE_ENTRY_POINT_SIZE 16
+
+typedef enum
+{
+    SHADER_BUNDLE_STAGE_VERTEX,
+    SHADER_BUNDLE_STAGE_FRAGMENT,
+    SHADER_BUNDLE_STAGE_COMPUTE,
+    
+} ShaderBundleStage;
+
+typedef struct
+{
+    Uint32 magic;
+    Uint32 version;
+    Uint32 entryCount;
+    Uint32 dataOffset;
+    
+} ShaderBundleHeader;
+
+// One per shader, sorted by name
+typedef struct
+{
+    char name[SHADER_BUNDLE_NAME_SIZE];
+    char entryPoint[SHADER_BUNDLE_ENTRY_POINT_SIZE];
+    Uint32 stage;
+    Uint32 samplerCount;
+    Uint32 uniformCount;
+    Uint32 readOnlyStorageBufferCount;
+    Uint32 readWriteStorageBufferCount;
+    Uint32 threadCount;
+    
+    // Relative to the start of the file
+    Uint32 offset;
+    Uint32 size;
+    
+} ShaderBundleEntry;
+
+SDL_COMPILE_TIME_ASSERT(ShaderBundleHeader, sizeof(ShaderBundleHeader) == 16);
+SDL_COMPILE_TIME_ASSERT(ShaderBundleEntry, sizeof(ShaderBundleEntry) == 80);
+
+typedef struct
+{
+    // The whole file, read in one go and kept for the lifetime of the app
+    Uint8 *data;
+    size_t size;
+    
+    ShaderBundleEntry *entries;
+    Uint32 entryCount;
+    
+} ShaderBundle;
+
+#define MAX_PIPELINE_VERTEX_BUFFERS 2
+#define MAX_PIPELINE_VERTEX_ATTRIBUTES 8
+#define MAX_SHADER_NAME 64
+
+// Everything that makes one graphics pipeline different from another
+typedef struct
+{
+    // Names in the shader bundle, which also has their resource counts
+    const char *shaderVertex;
+    const char *shaderFragment;
+    
+    SDL_GPUVertexBufferDescription vertexBuffers[MAX_PIPELINE_VERTEX_BUFFERS];
+    Uint32 vertexBufferCount;
+    SDL_GPUVertexAttribute vertexAttributes[MAX_PIPELINE_VERTEX_ATTRIBUTES];
+    Uint32 vertexAttributeCount;
+    
+    SDL_GPUTextureFormat targetFormat;
+    BlendMode blendMode;
+    
+} PipelineDesc;
+
+typedef struct
+{
+    Uint64 hash;
+    char name[MAX_SHADER_NAME];
+    SDL_GPUShader *shader;
+    
+} CachedShader;
+
+typedef struct
+{
+    Uint64 hash;
+    PipelineDesc desc;
+    char shaderVertex[MAX_SHADER_NAME];
+    char shaderFragment[MAX_SHADER_NAME];
+    SDL_GPUGraphicsPipeline *pipeline;
+    
+} CachedPipeline;
+
+// Open addressed tables, sizes must be powers of two
+#define SHADER_CACHE_SIZE 64
+#define PIPELINE_CACHE_SIZE 256
+
+typedef struct
+{
+    // Lookups can come from the startup workers, creation runs unlocked
+    SDL_Mutex *mutex;
+    
+    CachedShader shaders[SHADER_CACHE_SIZE];
+    Uint32 shaderCount;
+    CachedPipeline pipelines[PIPELINE_CACHE_SIZE];
+    Uint32 pipelineCount;
+    
+    Uint32 shaderHits;
+    Uint32 shaderMisses;
+    Uint32 pipelineHits;
+    Uint32 pipelineMisses;
+    
+} PipelineCache;
+
+// A pipeline created on a worker thread while the first frames are shown
+typedef struct
+{
+    // Either a cached graphics pipeline, or a compute pipeline by name.
+    // Graphics jobs with no destination only warm the cache.
+    PipelineDesc desc;
+    SDL_GPUGraphicsPipeline **graphics;
+    const char *computeShader;
+    SDL_GPUComputePipeline **compute;
+    
+} StartupJob;
+
+#define MAX_STARTUP_JOBS 16
+#define MAX_STARTUP_WORKERS 8
+
+typedef struct
+{
+    // The shader bundle is read with async I/O
+    SDL_AsyncIOQueue *queue;
+    bool bundleLoaded;
+    
+    // Workers take jobs in order until there are none left
+    StartupJob jobs[MAX_STARTUP_JOBS];
+    Uint32 jobCount;
+    SDL_AtomicInt nextJob;
+    SDL_AtomicInt finishedJobCount;
+    
+    SDL_Thread *workers[MAX_STARTUP_WORKERS];
+    Uint32 workerCount;
+    
+    // Set once every pipeline exists and the workers are gone
+    bool ready;
+    Uint64 startTime;
+    
+} StartupLoader;
+
+typedef struct
+{
+    SDL_GPUTexture *texture;
+    Uint32 width;
+    Uint32 height;
+    SDL_GPUTextureFormat format;
+    SDL_GPUTextureUsageFlags usage;
+    
+    bool inUse;
+    Uint64 lastUsedFrame;
+    
+} PooledTarget;
+
+#define MAX_POOLED_TARGETS 16
+
+// Sizes are rounded up to this, so dragging a window edge keeps hitting
+// the same texture instead of allocating one per pixel
+#define TARGET_POOL_BUCKET 128
+
+// Textures unused for this many frames are released, long enough that
+// dragging back and forth across a bucket boundary reuses them
+#define TARGET_POOL_MAX_UNUSED_FRAMES 60
+
+// Render targets that outlive a frame but not their users
+typedef struct
+{
+    PooledTarget targets[MAX_POOLED_TARGETS];
+    Uint32 count;
+    
+} TargetPool;
+
+typedef enum
+{
+    // The pass draws on top of what's there
+    RENDER_GRAPH_PRESERVE,
+    // The pass starts from the clear color
+    RENDER_GRAPH_CLEAR,
+    // The pass covers every pixel, old contents don't matter
+    RENDER_GRAPH_OVERWRITE,
+    
+} RenderGraphWriteMode;
+
+typedef struct
+{
+    const char *name;
+    
+    // Imported textures are owned elsewhere, transient ones only exist
+    // between the first and last pass that uses them
+    SDL_GPUTexture *texture;
+    bool imported;
+    bool output;
+    
+    Uint32 width;
+    Uint32 height;
+    SDL_GPUTextureFormat format;
+    SDL_GPUTextureUsageFlags usage;
+    
+    // Filled in by render_graph_compile
+    Uint32 firstPass;
+    Uint32 lastPass;
+    
+    // Size of the texture it got, which may be larger than asked for
+    Uint32 textureWidth;
+    Uint32 textureHeight;
+    
+} RenderGraphResource;
+
+#define MAX_RENDER_GRAPH_RESOURCES 16
+#define MAX_RENDER_GRAPH_PASSES 16
+#define MAX_RENDER_GRAPH_READS 4
+#define RENDER_GRAPH_NONE 0xFFFFFFFF
+
+typedef struct
+{
+    const char *name;
+    
+    Uint32 reads[MAX_RENDER_GRAPH_READS];
+    Uint32 readCount;
+    
+    // One color target per pass, like render_pass
+    Uint32 write;
+    RenderGraphWriteMode writeMode;
+    SDL_FColor clearColor;
+    
+    // Filled in by render_graph_compile, the target has the cheapest
+    // load and store ops that keep the result correct
+    bool culled;
+    RenderTarget target;
+    
+} RenderGraphPass;
+
+// Passes are declared up front each frame, compiled, and then recorded
+// in order by the code that declared them
+typedef struct
+{
+    RenderGraphResource resources[MAX_RENDER_GRAPH_RESOURCES];
+    Uint32 resourceCount;
+    RenderGraphPass passes[MAX_RENDER_GRAPH_PASSES];
+    Uint32 passCount;
+    bool compiled;
+    
+    // Stats for the last frame
+    Uint32 culledPassCount;
+    Uint32 loadCount;
+    Uint32 storeCount;
+    
+} RenderGraph;
+
+// Format of the offscreen texture the scene is drawn into
+#define SCENE_TARGET_FORMAT SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM
+
+// Scales the scene's viewport to keep the frame time on budget
+typedef struct
+{
+    bool enabled;
+    float scale;
+    float minScale;
+    float maxScale;
+    
+    // Seconds, the smoothed time is an exponential moving average
+    float targetFrameTime;
+    float smoothedFrameTime;
+    Uint32 framesSinceChange;
+    Uint64 frameCount;
+    
+    // VSYNC and frame limits hold the frame time at the budget, so there
+    // the scale only goes up by probing a step at a time. A probe that has
+    // to be undone doubles the wait before the next one.
+    bool capped;
+    bool probing;
+    Uint32 probeInterval;
+    
+} DynamicResolution;
+
+// Frames on budget before the first probe, and the longest wait
+#define DYNAMIC_RESOLUTION_PROBE_FRAMES 120
+#define DYNAMIC_RESOLUTION_MAX_PROBE_FRAMES 3840
+
+// How frames are presented and paced, set from the command line
+typedef struct
+{
+    SDL_GPUPresentMode presentMode;
+    Uint32 framesInFlight;
+    
+    // Skip the frame instead of blocking when no swapchain image is free
+    bool nonBlockingAcquire;
+    
+    // Frames per second the loop is held to, 0 for no limit
+    Uint32 frameLimit;
+    Uint64 nextFrameTime;
+    Uint64 skippedFrames;
+    
+    // Only draw when something changed, blocking on events otherwise
+    bool idle;
+    bool dirty;
+    
+} FramePacing;
+
+// Offscreen target the headless benchmark renders into
+#define BENCHMARK_WIDTH 1920
+#define BENCHMARK_HEIGHT 1080
+#define BENCHMARK_TEXTURE_SIZE 16
+#define MAX_BENCHMARK_TEXTURES 64
+
+// Quads per flush, larger workloads go through the batch in pieces
+#define BENCHMARK_BATCH_QUADS 16384
+
+// Frames run before measuring, while caches and allocations settle
+#define BENCHMARK_WARMUP_FRAMES 30
+
+// Workload for the headless benchmark, set from the command line
+typedef struct
+{
+    bool enabled;
+    Uint32 quadCount;
+    Uint32 textureCount;
+    bool postProcess;
+    Uint32 frameCount;
+    
+    // Layout the batch writes, from --packed or --instanced
+    VertexFormat vertexFormat;
+    
+    // Read back the last frame, written out or checked against goldens
+    bool capture;
+    
+} BenchmarkConfig;
+
+// Downloads in flight, a capture is dropped when they are all busy
+#define READBACK_SLOTS 4
+#define MAX_READBACK_JOBS 16
+#define READBACK_NAME_SIZE 64
+
+typedef enum
+{
+    READBACK_FREE,
+    READBACK_RECORDED,
+    READBACK_IN_FLIGHT,
+    
+} ReadbackState;
+
+typedef enum
+{
+    CAPTURE_FORMAT_PPM,
+    CAPTURE_FORMAT_RAW,
+    CAPTURE_FORMAT_QOI,
+    
+} CaptureFormat;
+
+// A download recorded into its own command buffer, submitted after the
+// frame that rendered the texture and harvested once its fence signals
+typedef struct
+{
+    ReadbackState state;
+    SDL_GPUTransferBuffer *transfer;
+    Uint32 transferSize;
+    SDL_GPUCommandBuffer *cmdbuf;
+    SDL_GPUFence *fence;
+    
+    Uint32 width;
+    Uint32 height;
+    bool bgra;
+    char name[READBACK_NAME_SIZE];
+    
+} ReadbackSlot;
+
+// Pixels copied out of a slot, owned by the job until the worker is done
+typedef struct
+{
+    Uint8 *pixels;
+    Uint32 width;
+    Uint32 height;
+    bool bgra;
+    char name[READBACK_NAME_SIZE];
+    
+} ReadbackJob;
+
+typedef struct
+{
+    // Render thread only
+    ReadbackSlot slots[READBACK_SLOTS];
+    Uint64 captureCount;
+    Uint32 droppedCount;
+    
+    // Shared with the worker and guarded by the mutex
+    SDL_Mutex *mutex;
+    SDL_Condition *jobAvailable;
+    bool quit;
+    ReadbackJob jobs[MAX_READBACK_JOBS];
+    Uint32 jobFirst;
+    Uint32 jobCount;
+    SDL_Thread *worker;
+    
+    // Images are written to the directory in the capture format, or
+    // compared against the PPM with the same name in the golden directory
+    // when there is one
+    const char *directory;
+    const char *goldenDirectory;
+    CaptureFormat format;
+    Uint32 tolerance;
+    SDL_AtomicInt mismatchCount;
+    
+} Readback;
+
+// Trace events are collected per thread without locks and written out
+// as Chrome trace-event JSON by a background thread
+#define TRACE_EVENTS_PER_THREAD 16384
+#define MAX_TRACE_THREADS 32
+#define TRACE_FLUSH_INTERVAL_MS 100
+
+// Thread id used for the reconstructed GPU spans
+#define TRACE_GPU_THREAD 0
+
+typedef struct
+{
+    // Names must outlive the tracer, in practice string literals
+    const char *name;
+    Uint64 start;
+    Uint64 duration;
+    bool gpu;
+    
+} TraceEvent;
+
+// Filled by the thread that owns it, drained by the writer thread.
+// Positions only ever grow, the slot is position % size.
+typedef struct
+{
+    TraceEvent events[TRACE_EVENTS_PER_THREAD];
+    SDL_AtomicU32 head;
+    SDL_AtomicU32 tail;
+    SDL_ThreadID threadID;
+    
+} TraceBuffer;
+
+typedef struct
+{
+    // Checked first by every zone, so disabled tracing is a load and a branch
+    bool enabled;
+    Uint64 startTime;
+    
+    SDL_TLSID tls;
+    TraceBuffer *threads[MAX_TRACE_THREADS];
+    SDL_AtomicInt threadCount;
+    SDL_AtomicInt droppedCount;
+    
+    // Only touched by the writer thread until it is joined
+    SDL_IOStream *file;
+    SDL_Thread *writer;
+    SDL_AtomicInt quit;
+    Uint64 eventCount;
+    
+} Tracer;
+
+// The parts of a frame timed on the CPU, in the order they happen
+typedef enum
+{
+    PHASE_EVENTS,
+    PHASE_ACQUIRE,
+    PHASE_UPDATE,
+    PHASE_UPLOAD,
+    PHASE_RECORD,
+    PHASE_SUBMIT,
+    PHASE_TOTAL,
+    PHASE_COUNT
+    
+} FramePhase;
+
+// Percentiles are taken over the last this many frames
+#define FRAME_TIMING_HISTORY 1024
+
+// Submitted frames whose fences haven't been seen signalled yet
+#define MAX_TIMED_FENCES 8
+
+typedef struct
+{
+    // Nanoseconds per phase, a ring over the most recent frames
+    Uint64 samples[PHASE_COUNT][FRAME_TIMING_HISTORY];
+    Uint32 sampleCount;
+    Uint32 next;
+    
+    // The frame being timed
+    Uint64 frameStart;
+    Uint64 phaseStart;
+    Uint64 current[PHASE_COUNT];
+    
+    // Every drawn frame, not just the ones in the ring
+    Uint64 frameCount;
+    const char *csvPath;
+    
+    // GPU completion, measured by polling a fence per submitted frame.
+    // Oldest fence first, completions land in their own ring.
+    bool gpuTiming;
+    SDL_GPUFence *fences[MAX_TIMED_FENCES];
+    Uint64 fenceSubmitTimes[MAX_TIMED_FENCES];
+    Uint32 fenceFramesInFlight[MAX_TIMED_FENCES];
+    Uint32 fenceFirst;
+    Uint32 fenceCount;
+    
+    Uint64 gpuLatency[FRAME_TIMING_HISTORY];
+    Uint64 gpuFramesInFlight[FRAME_TIMING_HISTORY];
+    Uint32 gpuSampleCount;
+    Uint32 gpuNext;
+    
+    // When the GPU last finished a frame, where the next GPU span starts
+    Uint64 gpuLastComplete;
+    
+} FrameTiming;
+
+typedef struct
+{
+	char *basePath;
+    ShaderBundle shaders;
+	SDL_Window* window;
+	SDL_GPUDevice* device;
+	float deltaTime;
+    float time;
+    
+    // Frames the GPU may be working on, and the number of frames submitted
+    Uint32 framesInFlight;
+    Uint64 frameIndex;
+    
+    Uint32 winWidth;
+    Uint32 winHeight;
+    
+    SDL_GPUSampler *samplers[SAMPLER_COUNT];
+    
+    // Every graphics pipeline and shader comes from here and is owned by it
+    PipelineCache pipelineCache;
+    StartupLoader startup;
+    
+    // Uploads waiting for the next frame's command buffer
+    UploadQueue uploads;
+    SDL_GPUTexture *texture;
+    SDL_GPUTransferBuffer *transferBufferTexture;
+    
+    // Dynamic rendering
+    RenderBuffers buffersDynamic;
+    SDL_GPUGraphicsPipeline* pipelineDynamic;
+    SDL_GPUGraphicsPipeline* pipelineInstanced;
+    SDL_GPUGraphicsPipeline* pipelineBlended;
+    SpriteBatch batch;
+    
+    // GPU culled sprites
+    SDL_GPUComputePipeline* pipelineCull;
+    CullBuffers cull;
+    
+    // Sprite images packed into one texture
+    TextureAtlas atlas;
+    
+    // Textures loaded in the background, drawn as placeholders until resident
+    TextureStreamer streamer;
+    
+    // Workers that split up per-frame CPU work, like expanding sprites.
+    // Only the benchmark starts them, left zeroed every job runs inline
+    // on the thread that waits for it.
+    JobSystem jobs;
+    
+    // Post-process
+    SDL_GPUGraphicsPipeline* pipelinePostProcess;
+    
+    // The frame's passes, and the transient targets they draw into
+    RenderGraph graph;
+    TargetPool targetPool;
+    DynamicResolution dynamicResolution;
+    FramePacing pacing;
+    FrameTiming timing;
+    Tracer tracer;
+    Readback readback;
+    
+} Context;
+
+Uint32
+vertex_format_size(VertexFormat format)
+{
+    return (format == VERTEX_FORMAT_PACKED) ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+Uint32
+vertex_format_quad_size(VertexFormat format)
+{
+    // Bytes uploaded per quad, either four vertices or one instance
+    if (format == VERTEX_FORMAT_INSTANCE) return sizeof(SpriteInstance);
+    return vertex_format_size(format) * 4;
+}
+
+void
+trace_emit(Tracer *tracer,
+           const char *name,
+           Uint64 start, Uint64 end,
+           bool gpu)
+{
+    if (!tracer->enabled) return;
+    
+    // Each thread gets its own buffer the first time it emits
+    TraceBuffer *buffer = SDL_GetTLS(&tracer->tls);
+    if (!buffer)
+    {
+        int slot = SDL_AddAtomicInt(&tracer->threadCount, 1);
+        assert(slot < MAX_TRACE_THREADS);
+        
+        buffer = SDL_calloc(1, sizeof(TraceBuffer));
+        assert(buffer);
+        buffer->threadID = SDL_GetCurrentThreadID();
+        SDL_SetTLS(&tracer->tls, buffer, 0);
+        SDL_SetAtomicPointer((void **)&tracer->threads[slot], buffer);
+    }
+    
+    // Drop rather than wait when the writer falls behind
+    Uint32 head = SDL_GetAtomicU32(&buffer->head);
+    if (head - SDL_GetAtomicU32(&buffer->tail) == TRACE_EVENTS_PER_THREAD)
+    {
+        SDL_AddAtomicInt(&tracer->droppedCount, 1);
+        return;
+    }
+    
+    buffer->events[head % TRACE_EVENTS_PER_THREAD] =
+        (TraceEvent){ name, start, end - start, gpu };
+    SDL_SetAtomicU32(&buffer->head, head + 1);
+}
+
+Uint64
+trace_begin(Tracer *tracer)
+{
+    // Zero means the zone isn't recorded
+    return tracer->enabled ? SDL_GetTicksNS() : 0;
+}
+
+void
+trace_end(Tracer *tracer,
+          const char *name,
+          Uint64 start)
+{
+    if (!start) return;
+    trace_emit(tracer, name, start, SDL_GetTicksNS(), false);
+}
+
+void
+trace_drain(Tracer *tracer)
+{
+    // Complete events, timestamps in microseconds since the tracer started
+    Uint32 threadCount = SDL_min((Uint32)SDL_GetAtomicInt(&tracer->threadCount),
+                                 MAX_TRACE_THREADS);
+    for (Uint32 i = 0; i < threadCount; ++i)
+    {
+        // A thread may have taken the slot without publishing its buffer yet
+        TraceBuffer *buffer = SDL_GetAtomicPointer((void **)&tracer->threads[i]);
+        if (!buffer) continue;
+        
+        Uint32 head = SDL_GetAtomicU32(&buffer->head);
+        Uint32 tail = SDL_GetAtomicU32(&buffer->tail);
+        for (; tail != head; ++tail)
+        {
+            TraceEvent *event = buffer->events + tail % TRACE_EVENTS_PER_THREAD;
+            SDL_IOprintf(tracer->file,
+                         ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,"
+                         "\"ts\":%.3f,\"dur\":%.3f}",
+                         event->name,
+                         event->gpu ?
+                             (unsigned long long)TRACE_GPU_THREAD :
+                             (unsigned long long)buffer->threadID,
+                         ((Sint64)event->start - (Sint64)tracer->startTime) / 1000.0,
+                         event->duration / 1000.0);
+            tracer->eventCount++;
+        }
+        SDL_SetAtomicU32(&buffer->tail, tail);
+    }
+}
+
+int
+trace_writer(void *data)
+{
+    Tracer *tracer = data;
+    while (!SDL_GetAtomicInt(&tracer->quit))
+    {
+        trace_drain(tracer);
+        SDL_Delay(TRACE_FLUSH_INTERVAL_MS);
+    }
+    
+    // Whatever was emitted before release_tracer
+    trace_drain(tracer);
+    return 0;
+}
+
+void
+create_tracer(Tracer *tracer,
+              const char *path)
+{
+    *tracer = (Tracer){0};
+    tracer->file = SDL_IOFromFile(path, "w");
+    if (!tracer->file)
+    {
+        SDL_Log("Couldn't open trace %s: %s", path, SDL_GetError());
+        return;
+    }
+    
+    // The metadata event goes first so every event after it starts with a comma
+    SDL_IOprintf(tracer->file,
+                 "{\"traceEvents\":[\n"
+                 "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                 "\"args\":{\"name\":\"GPU\"}}",
+                 TRACE_GPU_THREAD);
+    
+    tracer->startTime = SDL_GetTicksNS();
+    tracer->writer = SDL_CreateThread(trace_writer, "trace writer", tracer);
+    assert(tracer->writer);
+    tracer->enabled = true;
+}
+
+void
+release_tracer(Tracer *tracer)
+{
+    // Every other thread that emits has to be done by now
+    if (!tracer->enabled) return;
+    tracer->enabled = false;
+    
+    SDL_SetAtomicInt(&tracer->quit, 1);
+    SDL_WaitThread(tracer->writer, 0);
+    
+    SDL_IOprintf(tracer->file, "\n]}\n");
+    SDL_CloseIO(tracer->file);
+    
+    SDL_Log("Trace: %llu events written, %d dropped",
+            (unsigned long long)tracer->eventCount,
+            SDL_GetAtomicInt(&tracer->droppedCount));
+    
+    Uint32 threadCount = SDL_min((Uint32)SDL_GetAtomicInt(&tracer->threadCount),
+                                 MAX_TRACE_THREADS);
+    for (Uint32 i = 0; i < threadCount; ++i)
+    {
+        SDL_free(tracer->threads[i]);
+    }
+}
+
+void
+shader_bundle_init(Context *context,
+                   void *data,
+                   size_t size)
+{
+    // Takes ownership of the data, the whole file kept for the
+    // lifetime of the app
+    ShaderBundle *bundle = &context->shaders;
+    bundle->data = data;
+    bundle->size = size;
+    assert(bundle->data);
+    
+    ShaderBundleHeader *header = (ShaderBundleHeader *)bundle->data;
+    assert(bundle->size >= sizeof(ShaderBundleHeader));
+    assert(header->magic == SHADER_BUNDLE_MAGIC);
+    assert(header->version == SHADER_BUNDLE_VERSION);
+    assert(header->dataOffset ==
+           sizeof(ShaderBundleHeader) + header->entryCount * sizeof(ShaderBundleEntry));
+    assert(header->dataOffset <= bundle->size);
+    
+    bundle->entries = (ShaderBundleEntry *)(bundle->data + sizeof(ShaderBundleHeader));
+    bundle->entryCount = header->entryCount;
+    
+    for (Uint32 i = 0; i < bundle->entryCount; ++i)
+    {
+        ShaderBundleEntry *entry = bundle->entries + i;
+        assert(entry->offset >= header->dataOffset);
+        assert((Uint64)entry->offset + entry->size <= bundle->size);
+        entry->name[SHADER_BUNDLE_NAME_SIZE - 1] = 0;
+        entry->entryPoint[SHADER_BUNDLE_ENTRY_POINT_SIZE - 1] = 0;
+    }
+}
+
+void
+release_shader_bundle(Context *context)
+{
+    SDL_free(context->shaders.data);
+    context->shaders = (ShaderBundle){0};
+}
+
+ShaderBundleEntry *
+shader_bundle_find(Context *context,
+                   const char *shaderName)
+{
+    // Binary search, the packer sorts the entries by name
+    ShaderBundle *bundle = &context->shaders;
+    Uint32 first = 0;
+    Uint32 last = bundle->entryCount;
+    while (first < last)
+    {
+        Uint32 middle = first + (last - first) / 2;
+        int order = SDL_strcmp(shaderName, bundle->entries[middle].name);
+        if (order == 0) return bundle->entries + middle;
+        if (order < 0) last = middle;
+        else first = middle + 1;
+    }
+    
+    SDL_Log("Shader %s is not in the bundle", shaderName);
+    return 0;
+}
+
+SDL_GPUShader*
+shader_load(Context* context,
+            const char* shaderName)
+{
+    ShaderBundleEntry *entry = shader_bundle_find(context, shaderName);
+    assert(entry);
+    assert(entry->stage == SHADER_BUNDLE_STAGE_VERTEX ||
+           entry->stage == SHADER_BUNDLE_STAGE_FRAGMENT);
+    
+    // Create the shader straight from the bundle memory
+    SDL_GPUShaderCreateInfo shaderInfo =
+    {
+        entry->size,
+        context->shaders.data + entry->offset,
+        entry->entryPoint,
+        SDL_GPU_SHADERFORMAT_SPIRV,
+        (entry->stage == SHADER_BUNDLE_STAGE_VERTEX) ?
+            SDL_GPU_SHADERSTAGE_VERTEX :
+            SDL_GPU_SHADERSTAGE_FRAGMENT,
+        entry->samplerCount,
+        0, // storage textures
+        0, // storage buffers
+        entry->uniformCount // uniform buffers
+    };
+    
+    SDL_GPUShader* shader = SDL_CreateGPUShader(context->device, &shaderInfo);
+    assert(shader);
+    
+    return shader;
+}
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+Uint64
+hash_bytes(Uint64 hash, const void *data, size_t size)
+{
+    // FNV-1a
+    const Uint8 *bytes = data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+void
+create_pipeline_cache(Context *context)
+{
+    context->pipelineCache = (PipelineCache){0};
+    context->pipelineCache.mutex = SDL_CreateMutex();
+    assert(context->pipelineCache.mutex);
+}
+
+Uint32
+shader_cache_slot(PipelineCache *cache,
+                  Uint64 hash,
+                  const char *shaderName)
+{
+    // Either the matching entry or the empty slot it would go in
+    Uint32 slot = (Uint32)hash & (SHADER_CACHE_SIZE - 1);
+    for (;;)
+    {
+        CachedShader *entry = cache->shaders + slot;
+        if (!entry->shader) break;
+        if (entry->hash == hash && SDL_strcmp(entry->name, shaderName) == 0) break;
+        
+        slot = (slot + 1) & (SHADER_CACHE_SIZE - 1);
+    }
+    return slot;
+}
+
+SDL_GPUShader *
+pipeline_cache_shader(Context *context,
+                      const char *shaderName)
+{
+    PipelineCache *cache = &context->pipelineCache;
+    
+    Uint64 hash = hash_bytes(HASH_SEED, shaderName, SDL_strlen(shaderName));
+    
+    SDL_LockMutex(cache->mutex);
+    SDL_GPUShader *result = cache->shaders[shader_cache_slot(cache, hash, shaderName)].shader;
+    if (result) cache->shaderHits++;
+    SDL_UnlockMutex(cache->mutex);
+    
+    if (result) return result;
+    
+    // Create without holding the lock so other workers keep going
+    assert(SDL_strlen(shaderName) < MAX_SHADER_NAME);
+    SDL_GPUShader *shader = shader_load(context, shaderName);
+    
+    SDL_LockMutex(cache->mutex);
+    
+    CachedShader *entry = cache->shaders + shader_cache_slot(cache, hash, shaderName);
+    if (entry->shader)
+    {
+        // Another worker got there first, use theirs
+        SDL_ReleaseGPUShader(context->device, shader);
+    }
+    else
+    {
+        // Keep the table at most three quarters full so probes stay short
+        assert(cache->shaderCount < SHADER_CACHE_SIZE * 3 / 4);
+        
+        entry->hash = hash;
+        SDL_strlcpy(entry->name, shaderName, sizeof(entry->name));
+        entry->shader = shader;
+        cache->shaderCount++;
+    }
+    cache->shaderMisses++;
+    result = entry->shader;
+    
+    SDL_UnlockMutex(cache->mutex);
+    
+    return result;
+}
+
+Uint64
+pipeline_desc_hash(const PipelineDesc *desc)
+{
+    // Field by field so padding and unused array slots don't matter
+    Uint64 hash = HASH_SEED;
+    hash = hash_bytes(hash, desc->shaderVertex, SDL_strlen(desc->shaderVertex) + 1);
+    hash = hash_bytes(hash, desc->shaderFragment, SDL_strlen(desc->shaderFragment) + 1);
+    hash = hash_bytes(hash, desc->vertexBuffers,
+                      desc->vertexBufferCount * sizeof(SDL_GPUVertexBufferDescription));
+    hash = hash_bytes(hash, &desc->vertexBufferCount, sizeof(Uint32));
+    hash = hash_bytes(hash, desc->vertexAttributes,
+                      desc->vertexAttributeCount * sizeof(SDL_GPUVertexAttribute));
+    hash = hash_bytes(hash, &desc->vertexAttributeCount, sizeof(Uint32));
+    hash = hash_bytes(hash, &desc->targetFormat, sizeof(desc->targetFormat));
+    hash = hash_bytes(hash, &desc->blendMode, sizeof(desc->blendMode));
+    return hash;
+}
+
+bool
+pipeline_desc_equal(const PipelineDesc *a, const PipelineDesc *b)
+{
+    return SDL_strcmp(a->shaderVertex, b->shaderVertex) == 0 &&
+           SDL_strcmp(a->shaderFragment, b->shaderFragment) == 0 &&
+           a->vertexBufferCount == b->vertexBufferCount &&
+           SDL_memcmp(a->vertexBuffers, b->vertexBuffers,
+                      a->vertexBufferCount * sizeof(SDL_GPUVertexBufferDescription)) == 0 &&
+           a->vertexAttributeCount == b->vertexAttributeCount &&
+           SDL_memcmp(a->vertexAttributes, b->vertexAttributes,
+                      a->vertexAttributeCount * sizeof(SDL_GPUVertexAttribute)) == 0 &&
+           a->targetFormat == b->targetFormat &&
+           a->blendMode == b->blendMode;
+}
+
+SDL_GPUColorTargetBlendState
+blend_state(BlendMode blendMode)
+{
+    SDL_GPUColorTargetBlendState result = {0};
+    
+    switch (blendMode)
+    {
+        case BLEND_NONE:
+        {
+        } break;
+        
+        case BLEND_ALPHA:
+        {
+            result.src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA;
+            result.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+            result.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            result.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+            result.enable_blend = true;
+        } break;
+        
+        case BLEND_ADDITIVE:
+        {
+            result.src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA;
+            result.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            result.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            result.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            result.enable_blend = true;
+        } break;
+        
+        case BLEND_PREMULTIPLIED:
+        {
+            result.src_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            result.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+            result.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            result.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA;
+            result.enable_blend = true;
+        } break;
+    }
+    
+    result.color_blend_op = SDL_GPU_BLENDOP_ADD;
+    result.alpha_blend_op = SDL_GPU_BLENDOP_ADD;
+    
+    return result;
+}
+
+SDL_GPUGraphicsPipeline *
+create_pipeline(Context *context,
+                SDL_GPUShader *shaderVertex,
+                SDL_GPUShader *shaderFragment,
+                const PipelineDesc *desc)
+{
+    SDL_GPUGraphicsPipeline *result = 0;
+    
+    SDL_GPURasterizerState rasterizerState = { SDL_GPU_FILLMODE_FILL };
+    
+    // The vertex input state (buffrs and layouts)
+    SDL_GPUVertexInputState vertexInputState =
+    {
+        desc->vertexBuffers,
+        desc->vertexBufferCount,
+        desc->vertexAttributes,
+        desc->vertexAttributeCount
+    };
+    
+    SDL_GPUMultisampleState multisampleState = {0};
+    SDL_GPUDepthStencilState depthStencilState = {0};
+    
+    // The color target array
+    SDL_GPUColorTargetDescription colorTargetDescArray[] =
+    {
+        { desc->targetFormat, blend_state(desc->blendMode) }
+    };
+    
+    // The target config (color targets, etc)
+    SDL_GPUGraphicsPipelineTargetInfo targetInfo =
+    {
+        .color_target_descriptions = colorTargetDescArray,
+        .num_color_targets = SDL_arraysize(colorTargetDescArray),
+    };
+    
+    // The pipeline config
+    SDL_GPUGraphicsPipelineCreateInfo pipelineCreateInfo =
+    {
+		shaderVertex,
+		shaderFragment,
+        vertexInputState,
+		SDL_GPU_PRIMITIVETYPE_TRIANGLELIST,
+        rasterizerState,
+        multisampleState,
+        depthStencilState,
+        targetInfo
+    };
+    
+    result =
+        SDL_CreateGPUGraphicsPipeline(context->device,
+                                      &pipelineCreateInfo);
+    if (!result)
+    {
+        const char *error = SDL_GetError();
+        SDL_Log("%s", error);
+    }
+    
+    assert(result);
+    
+    return result;
+}
+
+Uint32
+pipeline_cache_slot(PipelineCache *cache,
+                    Uint64 hash,
+                    const PipelineDesc *desc)
+{
+    // Either the matching entry or the empty slot it would go in
+    Uint32 slot = (Uint32)hash & (PIPELINE_CACHE_SIZE - 1);
+    for (;;)
+    {
+        CachedPipeline *entry = cache->pipelines + slot;
+        if (!entry->pipeline) break;
+        if (entry->hash == hash && pipeline_desc_equal(&entry->desc, desc)) break;
+        
+        slot = (slot + 1) & (PIPELINE_CACHE_SIZE - 1);
+    }
+    return slot;
+}
+
+SDL_GPUGraphicsPipeline *
+pipeline_cache_get(Context *context,
+                   const PipelineDesc *desc)
+{
+    PipelineCache *cache = &context->pipelineCache;
+    
+    Uint64 hash = pipeline_desc_hash(desc);
+    
+    SDL_LockMutex(cache->mutex);
+    SDL_GPUGraphicsPipeline *result =
+        cache->pipelines[pipeline_cache_slot(cache, hash, desc)].pipeline;
+    if (result) cache->pipelineHits++;
+    SDL_UnlockMutex(cache->mutex);
+    
+    if (result) return result;
+    
+    assert(SDL_strlen(desc->shaderVertex) < MAX_SHADER_NAME &&
+           SDL_strlen(desc->shaderFragment) < MAX_SHADER_NAME);
+    
+    // Variants only differ in state, so their shaders are usually cached
+    SDL_GPUShader *shaderVertex = pipeline_cache_shader(context, desc->shaderVertex);
+    SDL_GPUShader *shaderFragment = pipeline_cache_shader(context, desc->shaderFragment);
+    SDL_GPUGraphicsPipeline *pipeline =
+        create_pipeline(context, shaderVertex, shaderFragment, desc);
+    
+    SDL_LockMutex(cache->mutex);
+    
+    CachedPipeline *entry = cache->pipelines + pipeline_cache_slot(cache, hash, desc);
+    if (entry->pipeline)
+    {
+        // Another worker got there first, use theirs
+        SDL_ReleaseGPUGraphicsPipeline(context->device, pipeline);
+    }
+    else
+    {
+        assert(cache->pipelineCount < PIPELINE_CACHE_SIZE * 3 / 4);
+        
+        // The key keeps its own copy of the names
+        entry->hash = hash;
+        entry->desc = *desc;
+        SDL_strlcpy(entry->shaderVertex, desc->shaderVertex, MAX_SHADER_NAME);
+        SDL_strlcpy(entry->shaderFragment, desc->shaderFragment, MAX_SHADER_NAME);
+        entry->desc.shaderVertex = entry->shaderVertex;
+        entry->desc.shaderFragment = entry->shaderFragment;
+        entry->pipeline = pipeline;
+        cache->pipelineCount++;
+    }
+    cache->pipelineMisses++;
+    result = entry->pipeline;
+    
+    SDL_UnlockMutex(cache->mutex);
+    
+    return result;
+}
+
+void
+release_pipeline_cache(Context *context)
+{
+    PipelineCache *cache = &context->pipelineCache;
+    
+    SDL_Log("Pipeline cache: %u pipelines, %u hits, %u misses",
+            cache->pipelineCount, cache->pipelineHits, cache->pipelineMisses);
+    SDL_Log("Shader cache: %u shaders, %u hits, %u misses",
+            cache->shaderCount, cache->shaderHits, cache->shaderMisses);
+    
+    for (Uint32 i = 0; i < PIPELINE_CACHE_SIZE; ++i)
+    {
+        if (cache->pipelines[i].pipeline)
+        {
+            SDL_ReleaseGPUGraphicsPipeline(context->device, cache->pipelines[i].pipeline);
+        }
+    }
+    for (Uint32 i = 0; i < SHADER_CACHE_SIZE; ++i)
+    {
+        if (cache->shaders[i].shader)
+        {
+            SDL_ReleaseGPUShader(context->device, cache->shaders[i].shader);
+        }
+    }
+    
+    SDL_DestroyMutex(cache->mutex);
+    *cache = (PipelineCache){0};
+}
+
+PipelineDesc
+pipeline_sprite_desc(VertexFormat format,
+                     BlendMode blendMode)
+{
+    // Both vertex layouts use the same shaders since the packed
+    // attributes are expanded to floats before the shader
+    PipelineDesc desc =
+    {
+        .shaderVertex = "vert",
+        .shaderFragment = "frag",
+        .vertexBuffers =
+        {
+            { 0, vertex_format_size(format), SDL_GPU_VERTEXINPUTRATE_VERTEX, 0 }
+        },
+        .vertexBufferCount = 1,
+        .targetFormat = SCENE_TARGET_FORMAT,
+        .blendMode = blendMode
+    };
+    
+    if (format == VERTEX_FORMAT_FLOAT)
+    {
+        SDL_GPUVertexAttribute vertexAttribArray[] =
+        {
+            { 0, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2, 0 },
+            { 1, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2, sizeof(float) * 2 },
+            { 2, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT4, sizeof(float) * 4 }
+        };
+        SDL_memcpy(desc.vertexAttributes, vertexAttribArray, sizeof(vertexAttribArray));
+        desc.vertexAttributeCount = SDL_arraysize(vertexAttribArray);
+    }
+    else if (format == VERTEX_FORMAT_PACKED)
+    {
+        SDL_GPUVertexAttribute vertexAttribArray[] =
+        {
+            { 0, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2, 0 },
+            { 1, 0, SDL_GPU_VERTEXELEMENTFORMAT_USHORT2_NORM, sizeof(float) * 2 },
+            { 2, 0, SDL_GPU_VERTEXELEMENTFORMAT_UBYTE4_NORM, sizeof(float) * 2 + sizeof(Uint16) * 2 }
+        };
+        SDL_memcpy(desc.vertexAttributes, vertexAttribArray, sizeof(vertexAttribArray));
+        desc.vertexAttributeCount = SDL_arraysize(vertexAttribArray);
+    }
+    else
+    {
+        // Advance once per sprite instead of once per vertex, the
+        // fragment shader is shared
+        SDL_GPUVertexAttribute vertexAttribArray[] =
+        {
+            { 0, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2, offsetof(SpriteInstance, x) },
+            { 1, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT2, offsetof(SpriteInstance, w) },
+            { 2, 0, SDL_GPU_VERTEXELEMENTFORMAT_USHORT4_NORM, offsetof(SpriteInstance, u0) },
+            { 3, 0, SDL_GPU_VERTEXELEMENTFORMAT_UBYTE4_NORM, offsetof(SpriteInstance, r) },
+            { 4, 0, SDL_GPU_VERTEXELEMENTFORMAT_FLOAT, offsetof(SpriteInstance, rotation) }
+        };
+        desc.shaderVertex = "instvert";
+        desc.vertexBuffers[0] =
+            (SDL_GPUVertexBufferDescription)
+            {
+                0, sizeof(SpriteInstance), SDL_GPU_VERTEXINPUTRATE_INSTANCE, 0
+            };
+        SDL_memcpy(desc.vertexAttributes, vertexAttribArray, sizeof(vertexAttribArray));
+        desc.vertexAttributeCount = SDL_arraysize(vertexAttribArray);
+    }
+    
+    return desc;
+}
+
+SDL_GPUComputePipeline *
+create_pipeline_compute(Context *context,
+                        const char *shaderName)
+{
+    ShaderBundleEntry *entry = shader_bundle_find(context, shaderName);
+    assert(entry && entry->stage == SHADER_BUNDLE_STAGE_COMPUTE);
+    
+    SDL_GPUComputePipelineCreateInfo pipelineCreateInfo =
+    {
+        entry->size,
+        context->shaders.data + entry->offset,
+        entry->entryPoint,
+        SDL_GPU_SHADERFORMAT_SPIRV,
+        entry->samplerCount,
+        0, // readonly storage textures
+        entry->readOnlyStorageBufferCount,
+        0, // readwrite storage textures
+        entry->readWriteStorageBufferCount,
+        entry->uniformCount,
+        entry->threadCount, 1, 1 // thread count
+    };
+    
+    SDL_GPUComputePipeline *result =
+        SDL_CreateGPUComputePipeline(context->device, &pipelineCreateInfo);
+    if (!result)
+    {
+        const char *error = SDL_GetError();
+        SDL_Log("%s", error);
+    }
+    
+    assert(result);
+    
+    return result;
+}
+
+PipelineDesc
+pipeline_postprocess_desc(Context *context)
+{
+    // Full-screen triangle generated in the vertex shader, no vertex input
+    PipelineDesc desc =
+    {
+        .shaderVertex = "ppvert",
+        .shaderFragment = "ppfrag",
+        .targetFormat = context->window ?
+            SDL_GetGPUSwapchainTextureFormat(context->device, context->window) :
+            SCENE_TARGET_FORMAT,
+        .blendMode = BLEND_NONE
+    };
+    
+    return desc;
+}
+
+int
+startup_worker(void *data)
+{
+    Context *context = data;
+    StartupLoader *startup = &context->startup;
+    
+    for (;;)
+    {
+        Uint32 jobIndex = (Uint32)SDL_AddAtomicInt(&startup->nextJob, 1);
+        if (jobIndex >= startup->jobCount) break;
+        
+        StartupJob *job = startup->jobs + jobIndex;
+        Uint64 zone = trace_begin(&context->tracer);
+        if (job->computeShader)
+        {
+            *job->compute = create_pipeline_compute(context, job->computeShader);
+        }
+        else
+        {
+            SDL_GPUGraphicsPipeline *pipeline = pipeline_cache_get(context, &job->desc);
+            if (job->graphics) *job->graphics = pipeline;
+        }
+        trace_end(&context->tracer, "create_pipeline", zone);
+        
+        SDL_AddAtomicInt(&startup->finishedJobCount, 1);
+    }
+    
+    return 0;
+}
+
+void
+startup_add_graphics(Context *context,
+                     SDL_GPUGraphicsPipeline **pipeline,
+                     PipelineDesc desc)
+{
+    StartupLoader *startup = &context->startup;
+    assert(startup->jobCount < MAX_STARTUP_JOBS);
+    startup->jobs[startup->jobCount++] = (StartupJob){ .desc = desc, .graphics = pipeline };
+}
+
+void
+startup_add_compute(Context *context,
+                    SDL_GPUComputePipeline **pipeline,
+                    const char *shaderName)
+{
+    StartupLoader *startup = &context->startup;
+    assert(startup->jobCount < MAX_STARTUP_JOBS);
+    startup->jobs[startup->jobCount++] =
+        (StartupJob){ .computeShader = shaderName, .compute = pipeline };
+}
+
+void
+startup_begin(Context *context,
+              char *bundleFilename)
+{
+    // Jobs are added after this and before the first update
+    StartupLoader *startup = &context->startup;
+    startup->startTime = SDL_GetTicksNS();
+    
+    // Construct a full path with basePath and bundleFilename
+	char fullPath[512] = {0};
+    SDL_strlcat(fullPath, context->basePath, sizeof(fullPath));
+    SDL_strlcat(fullPath, bundleFilename, sizeof(fullPath));
+    
+    // Every shader in one read, completed on an SDL I/O thread
+    startup->queue = SDL_CreateAsyncIOQueue();
+    assert(startup->queue);
+    assert(SDL_LoadFileAsync(fullPath, startup->queue, 0));
+}
+
+bool
+startup_update(Context *context,
+               bool wait)
+{
+    // Returns true once every pipeline is ready, never blocks unless asked to
+    StartupLoader *startup = &context->startup;
+    if (startup->ready) return true;
+    
+    if (!startup->bundleLoaded)
+    {
+        SDL_AsyncIOOutcome outcome;
+        bool done = wait ?
+            SDL_WaitAsyncIOResult(startup->queue, &outcome, -1) :
+            SDL_GetAsyncIOResult(startup->queue, &outcome);
+        if (!done) return false;
+        
+        if (outcome.result != SDL_ASYNCIO_COMPLETE)
+        {
+            SDL_Log("Failed to load the shader bundle: %s", SDL_GetError());
+        }
+        assert(outcome.result == SDL_ASYNCIO_COMPLETE);
+        
+        shader_bundle_init(context, outcome.buffer, outcome.bytes_transferred);
+        SDL_DestroyAsyncIOQueue(startup->queue);
+        startup->queue = 0;
+        startup->bundleLoaded = true;
+        
+        // Now the code is in memory, create everything in parallel
+        int workerCount = SDL_GetNumLogicalCPUCores();
+        startup->workerCount = SDL_clamp(workerCount, 1, MAX_STARTUP_WORKERS);
+        startup->workerCount = SDL_min(startup->workerCount, startup->jobCount);
+        
+        for (Uint32 i = 0; i < startup->workerCount; ++i)
+        {
+            startup->workers[i] = SDL_CreateThread(startup_worker,
+                                                   "StartupWorker",
+                                                   context);
+            assert(startup->workers[i]);
+        }
+    }
+    
+    if (!wait &&
+        (Uint32)SDL_GetAtomicInt(&startup->finishedJobCount) < startup->jobCount)
+    {
+        return false;
+    }
+    
+    // Joining makes the workers' results visible to this thread
+    for (Uint32 i = 0; i < startup->workerCount; ++i)
+    {
+        SDL_WaitThread(startup->workers[i], 0);
+    }
+    
+    startup->ready = true;
+    SDL_Log("Pipelines ready after %.2f ms",
+            (SDL_GetTicksNS() - startup->startTime) / 1000000.0);
+    
+    return true;
+}
+
+void
+release_startup(Context *context)
+{
+    // Finish whatever is still running so nothing is left half created
+    startup_update(context, true);
+}
+
+void
+release_buffers(Context *context,
+                RenderBuffers *buffers)
+{
+    SDL_ReleaseGPUBuffer(context->device, buffers->vertex);
+    SDL_ReleaseGPUBuffer(context->device, buffers->index);
+    SDL_ReleaseGPUTransferBuffer(context->device, buffers->transfer);
+}
+
+void
+create_quad_indices(Context *context,
+                     RenderBuffers *buffers)
+{
+    // Every quad uses the same 0,1,2,2,3,0 pattern, so build it once
+    bool use16Bit =
+        buffers->indexElementSize == SDL_GPU_INDEXELEMENTSIZE_16BIT;
+    Uint32 indexSize = use16Bit ? sizeof(Uint16) : sizeof(Uint32);
+    Uint32 dataSize = buffers->maxQuadCount * 6 * indexSize;
+    
+    SDL_GPUTransferBuffer *transfer =
+        SDL_CreateGPUTransferBuffer(context->device,
+                                    &(SDL_GPUTransferBufferCreateInfo)
+                                    {
+                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                        dataSize
+                                    });
+    
+    void *destData = SDL_MapGPUTransferBuffer(context->device, transfer, false);
+    
+    Uint16 *indices16 = destData;
+    Uint32 *indices32 = destData;
+    Uint32 quadIndices[] = { 0, 1, 2, 2, 3, 0 };
+    
+    for (Uint32 quadIndex = 0; quadIndex < buffers->maxQuadCount; ++quadIndex)
+    {
+        for (Uint32 i = 0; i < SDL_arraysize(quadIndices); ++i)
+        {
+            Uint32 index = quadIndex * 4 + quadIndices[i];
+            if (use16Bit)
+            {
+                *indices16++ = (Uint16)index;
+            }
+            else
+            {
+                *indices32++ = index;
+            }
+        }
+    }
+    
+    SDL_UnmapGPUTransferBuffer(context->device, transfer);
+    
+    // This only happens once at startup, so upload it right away
+    SDL_GPUCommandBuffer *cmdBuf = SDL_AcquireGPUCommandBuffer(context->device);
+    SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdBuf);
+    
+    SDL_UploadToGPUBuffer(copyPass,
+                          &(SDL_GPUTransferBufferLocation)
+                          {
+                              transfer,
+                              0 // offset
+                          },
+                          &(SDL_GPUBufferRegion)
+                          {
+                              buffers->index, 0, dataSize
+                          },
+                          false);
+    
+    SDL_EndGPUCopyPass(copyPass);
+    SDL_SubmitGPUCommandBuffer(cmdBuf);
+    
+    // Safe to release now, SDL keeps it alive until the copy is done
+    SDL_ReleaseGPUTransferBuffer(context->device, transfer);
+}
+
+RenderBuffers
+create_buffers(Context *context,
+               Uint32 maxSizeVertex,
+               Uint32 maxQuadCount,
+               Uint32 frameCount)
+{
+    RenderBuffers result = {0};
+    result.maxSizeVertex = maxSizeVertex;
+    result.maxQuadCount = maxQuadCount;
+    
+    // 16-bit indices are enough as long as every vertex can be addressed
+    result.indexElementSize = (maxQuadCount * 4 <= 0x10000) ?
+        SDL_GPU_INDEXELEMENTSIZE_16BIT :
+        SDL_GPU_INDEXELEMENTSIZE_32BIT;
+    
+    Uint32 maxSizeIndex = maxQuadCount * 6 *
+        (result.indexElementSize == SDL_GPU_INDEXELEMENTSIZE_16BIT ?
+         sizeof(Uint16) : sizeof(Uint32));
+    
+    // Default to one slice per frame the GPU can have in flight
+    result.frameCount = frameCount ? frameCount : context->framesInFlight;
+    result.frameSize = maxSizeVertex;
+    
+    // Create vertex buffer
+    result.vertex = SDL_CreateGPUBuffer(context->device,
+                                        &(SDL_GPUBufferCreateInfo)
+                                        {
+                                            SDL_GPU_BUFFERUSAGE_VERTEX,
+                                            maxSizeVertex,
+                                            0
+                                        });
+    
+    // Create index buffer
+    result.index = SDL_CreateGPUBuffer(context->device,
+                                       &(SDL_GPUBufferCreateInfo)
+                                       {
+                                           SDL_GPU_BUFFERUSAGE_INDEX,
+                                           maxSizeIndex,
+                                           0
+                                       });
+    
+    create_quad_indices(context, &result);
+    
+    // Create transfer ring for vertex data, indices never change
+    result.transfer =
+        SDL_CreateGPUTransferBuffer(context->device,
+                                    &(SDL_GPUTransferBufferCreateInfo)
+                                    {
+                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                        result.frameSize * result.frameCount
+                                    });
+    
+    return result;
+}
+
+CullBuffers
+create_cull_buffers(Context *context,
+                    Uint32 maxSpriteCount)
+{
+    CullBuffers result = {0};
+    result.maxSpriteCount = maxSpriteCount;
+    
+    Uint32 spritesSize = maxSpriteCount * sizeof(SpriteInstance);
+    
+    // Input records, only ever read by the compute shader
+    result.sprites = SDL_CreateGPUBuffer(context->device,
+                                         &(SDL_GPUBufferCreateInfo)
+                                         {
+                                             SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ,
+                                             spritesSize,
+                                             0
+                                         });
+    
+    result.transfer =
+        SDL_CreateGPUTransferBuffer(context->device,
+                                    &(SDL_GPUTransferBufferCreateInfo)
+                                    {
+                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                        spritesSize
+                                    });
+    
+    // Compacted survivors, written by compute and read as instances
+    result.visible.vertex =
+        SDL_CreateGPUBuffer(context->device,
+                            &(SDL_GPUBufferCreateInfo)
+                            {
+                                SDL_GPU_BUFFERUSAGE_VERTEX |
+                                    SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE,
+                                spritesSize,
+                                0
+                            });
+    result.visible.maxSizeVertex = spritesSize;
+    
+    // Instances only need the indices of a single quad
+    result.visible.maxQuadCount = 1;
+    result.visible.indexElementSize = SDL_GPU_INDEXELEMENTSIZE_16BIT;
+    result.visible.index = SDL_CreateGPUBuffer(context->device,
+                                               &(SDL_GPUBufferCreateInfo)
+                                               {
+                                                   SDL_GPU_BUFFERUSAGE_INDEX,
+                                                   sizeof(Uint16) * 6,
+                                                   0
+                                               });
+    create_quad_indices(context, &result.visible);
+    
+    // Draw arguments, the compute shader counts instances into them
+    Uint32 indirectSize = sizeof(SDL_GPUIndexedIndirectDrawCommand);
+    result.indirect =
+        SDL_CreateGPUBuffer(context->device,
+                            &(SDL_GPUBufferCreateInfo)
+                            {
+                                SDL_GPU_BUFFERUSAGE_INDIRECT |
+                                    SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ |
+                                    SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE,
+                                indirectSize,
+                                0
+                            });
+    
+    // A copy of the empty draw that is copied over the arguments each frame
+    result.indirectReset =
+        SDL_CreateGPUBuffer(context->device,
+                            &(SDL_GPUBufferCreateInfo)
+                            {
+                                SDL_GPU_BUFFERUSAGE_INDIRECT,
+                                indirectSize,
+                                0
+                            });
+    
+    SDL_GPUTransferBuffer *transfer =
+        SDL_CreateGPUTransferBuffer(context->device,
+                                    &(SDL_GPUTransferBufferCreateInfo)
+                                    {
+                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                        indirectSize
+                                    });
+    
+    SDL_GPUIndexedIndirectDrawCommand *drawCommand =
+        SDL_MapGPUTransferBuffer(context->device, transfer, false);
+    *drawCommand = (SDL_GPUIndexedIndirectDrawCommand)
+    {
+        6, // index count
+        0, // instance count, counted by the compute shader
+        0, // first index
+        0, // vertex offset
+        0 // first instance
+    };
+    SDL_UnmapGPUTransferBuffer(context->device, transfer);
+    
+    // This only happens once at startup, so upload it right away
+    SDL_GPUCommandBuffer *cmdBuf = SDL_AcquireGPUCommandBuffer(context->device);
+    SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdBuf);
+    
+    SDL_UploadToGPUBuffer(copyPass,
+                          &(SDL_GPUTransferBufferLocation){ transfer, 0 },
+                          &(SDL_GPUBufferRegion){ result.indirectReset, 0, indirectSize },
+                          false);
+    
+    SDL_EndGPUCopyPass(copyPass);
+    SDL_SubmitGPUCommandBuffer(cmdBuf);
+    SDL_ReleaseGPUTransferBuffer(context->device, transfer);
+    
+    return result;
+}
+
+void
+release_cull_buffers(Context *context,
+                     CullBuffers *cull)
+{
+    SDL_ReleaseGPUBuffer(context->device, cull->sprites);
+    SDL_ReleaseGPUTransferBuffer(context->device, cull->transfer);
+    SDL_ReleaseGPUBuffer(context->device, cull->visible.vertex);
+    SDL_ReleaseGPUBuffer(context->device, cull->visible.index);
+    SDL_ReleaseGPUBuffer(context->device, cull->indirect);
+    SDL_ReleaseGPUBuffer(context->device, cull->indirectReset);
+}
+
+Uint32
+buffers_frame_offset(Context *context,
+                     RenderBuffers *buffers)
+{
+    // Once the swapchain image is acquired, the frame that last used this
+    // slice has finished on the GPU, so it can be written without waiting
+    return buffers->frameSize * (Uint32)(context->frameIndex % buffers->frameCount);
+}
+
+void *
+upload_queue_map(Context *context,
+                 SDL_GPUTransferBuffer *transfer)
+{
+    UploadQueue *queue = &context->uploads;
+    
+    // Whatever was queued from this transfer buffer is about to be
+    // overwritten, so drop it and let the new data replace it
+    Uint32 keepCount = 0;
+    for (Uint32 uploadIndex = 0; uploadIndex < queue->count; ++uploadIndex)
+    {
+        if (queue->uploads[uploadIndex].transfer != transfer)
+        {
+            queue->uploads[keepCount++] = queue->uploads[uploadIndex];
+        }
+    }
+    queue->count = keepCount;
+    
+    // Cycle so that we never wait on a copy the GPU hasn't finished yet
+    return SDL_MapGPUTransferBuffer(context->device, transfer, true);
+}
+
+void
+upload_queue_push(Context *context,
+                  PendingUpload upload)
+{
+    UploadQueue *queue = &context->uploads;
+    
+    if (queue->count == queue->capacity)
+    {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 64;
+        queue->uploads = SDL_realloc(queue->uploads,
+                                     queue->capacity * sizeof(PendingUpload));
+        assert(queue->uploads);
+    }
+    
+    queue->uploads[queue->count++] = upload;
+}
+
+void
+upload_queue_retire_texture(Context *context,
+                            SDL_GPUTexture *texture)
+{
+    UploadQueue *queue = &context->uploads;
+    
+    if (queue->retiredTextureCount == queue->retiredTextureCapacity)
+    {
+        queue->retiredTextureCapacity = queue->retiredTextureCapacity ?
+            queue->retiredTextureCapacity * 2 : 64;
+        queue->retiredTextures = SDL_realloc(queue->retiredTextures,
+                                             queue->retiredTextureCapacity * sizeof(SDL_GPUTexture *));
+        assert(queue->retiredTextures);
+    }
+    
+    queue->retiredTextures[queue->retiredTextureCount++] = texture;
+}
+
+void
+upload_queue_retire_transfer(Context *context,
+                             SDL_GPUTransferBuffer *transfer)
+{
+    UploadQueue *queue = &context->uploads;
+    
+    if (queue->retiredTransferCount == queue->retiredTransferCapacity)
+    {
+        queue->retiredTransferCapacity = queue->retiredTransferCapacity ?
+            queue->retiredTransferCapacity * 2 : 64;
+        queue->retiredTransfers = SDL_realloc(queue->retiredTransfers,
+                                              queue->retiredTransferCapacity * sizeof(SDL_GPUTransferBuffer *));
+        assert(queue->retiredTransfers);
+    }
+    
+    queue->retiredTransfers[queue->retiredTransferCount++] = transfer;
+}
+
+void
+upload_queue_generate_mipmaps(Context *context,
+                              SDL_GPUTexture *texture)
+{
+    UploadQueue *queue = &context->uploads;
+    
+    for (Uint32 i = 0; i < queue->mipmapTextureCount; ++i)
+    {
+        if (queue->mipmapTextures[i] == texture) return;
+    }
+    
+    assert(queue->mipmapTextureCount < MAX_PENDING_MIPMAPS);
+    queue->mipmapTextures[queue->mipmapTextureCount++] = texture;
+}
+
+void
+upload_queue_flush_retired(Context *context)
+{
+    UploadQueue *queue = &context->uploads;
+    
+    for (Uint32 i = 0; i < queue->retiredTextureCount; ++i)
+    {
+        SDL_ReleaseGPUTexture(context->device, queue->retiredTextures[i]);
+    }
+    for (Uint32 i = 0; i < queue->retiredTransferCount; ++i)
+    {
+        SDL_ReleaseGPUTransferBuffer(context->device, queue->retiredTransfers[i]);
+    }
+    queue->retiredTextureCount = 0;
+    queue->retiredTransferCount = 0;
+}
+
+void
+upload_queue_flush(Context *context,
+                   SDL_GPUCommandBuffer *cmdbuf)
+{
+    Uint64 zone = trace_begin(&context->tracer);
+    UploadQueue *queue = &context->uploads;
+    
+    if (queue->count > 0)
+    {
+        // Everything goes through a single copy pass at the start of the frame
+        SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdbuf);
+        
+        for (Uint32 uploadIndex = 0; uploadIndex < queue->count; ++uploadIndex)
+        {
+            PendingUpload *upload = queue->uploads + uploadIndex;
+            
+            if (upload->buffer)
+            {
+                SDL_UploadToGPUBuffer(copyPass,
+                                      &(SDL_GPUTransferBufferLocation)
+                                      {
+                                          upload->transfer,
+                                          upload->transferOffset
+                                      },
+                                      &(SDL_GPUBufferRegion)
+                                      {
+                                          upload->buffer,
+                                          upload->bufferOffset,
+                                          upload->size
+                                      },
+                                      upload->cycle);
+            }
+            else if (upload->sourceTexture)
+            {
+                SDL_CopyGPUTextureToTexture(copyPass,
+                                            &(SDL_GPUTextureLocation)
+                                            {
+                                                upload->sourceTexture,
+                                                0, // mip level
+                                                0, // layer
+                                                upload->sourceX,
+                                                upload->sourceY,
+                                                0 // z
+                                            },
+                                            &(SDL_GPUTextureLocation)
+                                            {
+                                                upload->texture,
+                                                0, // mip level
+                                                0, // layer
+                                                upload->x,
+                                                upload->y,
+                                                0 // z
+                                            },
+                                            upload->width,
+                                            upload->height,
+                                            1, // depth
+                                            upload->cycle);
+            }
+            else
+            {
+                SDL_UploadToGPUTexture(copyPass,
+                                       &(SDL_GPUTextureTransferInfo)
+                                       {
+                                           upload->transfer,
+                                           upload->transferOffset,
+                                           upload->width,
+                                           upload->height
+                                       },
+                                       &(SDL_GPUTextureRegion)
+                                       {
+                                           upload->texture,
+                                           0, // mip level
+                                           0, // layer
+                                           upload->x,
+                                           upload->y,
+                                           0, // z
+                                           upload->width,
+                                           upload->height,
+                                           1 // depth
+                                       },
+                                       upload->cycle);
+            }
+        }
+        
+        SDL_EndGPUCopyPass(copyPass);
+        queue->count = 0;
+    }
+    
+    // Mips are blits, which can't be recorded inside a copy pass
+    for (Uint32 i = 0; i < queue->mipmapTextureCount; ++i)
+    {
+        SDL_GenerateMipmapsForGPUTexture(cmdbuf, queue->mipmapTextures[i]);
+    }
+    queue->mipmapTextureCount = 0;
+    
+    // The copies are recorded now, SDL keeps these alive until they're done
+    upload_queue_flush_retired(context);
+    
+    queue->flushCount++;
+    trace_end(&context->tracer, "upload_queue_flush", zone);
+}
+
+void
+update_cull_sprites(Context *context,
+                    CullBuffers *cull,
+                    SpriteInstance *sprites,
+                    Uint32 spriteCount)
+{
+    assert(spriteCount <= cull->maxSpriteCount);
+    Uint32 dataSize = spriteCount * sizeof(SpriteInstance);
+    
+    SpriteInstance *destData = upload_queue_map(context, cull->transfer);
+    memcpy(destData, sprites, dataSize);
+    SDL_UnmapGPUTransferBuffer(context->device, cull->transfer);
+    
+    // Queue the upload, it is recorded with the next frame
+    if (dataSize > 0)
+    {
+        upload_queue_push(context,
+                          (PendingUpload)
+                          {
+                              .transfer = cull->transfer,
+                              .transferOffset = 0,
+                              .buffer = cull->sprites,
+                              .size = dataSize,
+                              .cycle = true
+                          });
+    }
+    
+    cull->spriteCount = spriteCount;
+}
+
+void
+cull_pass(Context *context,
+          SDL_GPUCommandBuffer *cmdbuf,
+          CullBuffers *cull,
+          float matrix[])
+{
+    // Start from an empty draw, the compute shader counts the instances
+    SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdbuf);
+    SDL_CopyGPUBufferToBuffer(copyPass,
+                              &(SDL_GPUBufferLocation){ cull->indirectReset, 0 },
+                              &(SDL_GPUBufferLocation){ cull->indirect, 0 },
+                              sizeof(SDL_GPUIndexedIndirectDrawCommand),
+                              true); // cycle
+    SDL_EndGPUCopyPass(copyPass);
+    
+    // Cycle the survivors so last frame's draw can still read its copy
+    SDL_GPUStorageBufferReadWriteBinding storageBindings[] =
+    {
+        { cull->visible.vertex, true },
+        { cull->indirect, false }
+    };
+    
+    SDL_GPUComputePass *computePass =
+        SDL_BeginGPUComputePass(cmdbuf,
+                                0, 0, // storage textures
+                                storageBindings,
+                                SDL_arraysize(storageBindings));
+    
+    SDL_BindGPUComputePipeline(computePass, context->pipelineCull);
+    SDL_BindGPUComputeStorageBuffers(computePass, 0, &cull->sprites, 1);
+    
+    CullUniforms uniforms = {0};
+    SDL_memcpy(uniforms.matrix, matrix, sizeof(uniforms.matrix));
+    uniforms.spriteCount = cull->spriteCount;
+    SDL_PushGPUComputeUniformData(cmdbuf, 0, &uniforms, sizeof(uniforms));
+    
+    Uint32 groupCount = (cull->spriteCount + CULL_THREAD_COUNT - 1) / CULL_THREAD_COUNT;
+    if (groupCount > 0)
+    {
+        SDL_DispatchGPUCompute(computePass, groupCount, 1, 1);
+    }
+    
+    SDL_EndGPUComputePass(computePass);
+}
+
+Uint32
+texture_mip_count(Uint32 width, Uint32 height)
+{
+    // Full chain down to 1x1
+    Uint32 size = SDL_max(width, height);
+    Uint32 result = 1;
+    while (size > 1)
+    {
+        size /= 2;
+        result++;
+    }
+    return result;
+}
+
+SDL_GPUTexture *
+create_texture_mipmapped(Context *context,
+                         Uint32 width, Uint32 height,
+                         Uint32 mipLevels)
+{
+    // Generating mips blits into each level, so it has to be a target
+    SDL_GPUTextureUsageFlags usage = SDL_GPU_TEXTUREUSAGE_SAMPLER;
+    if (mipLevels > 1) usage |= SDL_GPU_TEXTUREUSAGE_COLOR_TARGET;
+    
+    return SDL_CreateGPUTexture(context->device,
+                                &(SDL_GPUTextureCreateInfo)
+                                {
+                                    SDL_GPU_TEXTURETYPE_2D,
+                                    SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM,
+                                    usage,
+                                    width,
+                                    height,
+                                    1, // layer count
+                                    mipLevels,
+                                    SDL_GPU_SAMPLECOUNT_1
+                                });
+}
+
+void
+create_texture(Context *context,
+               Uint32 width, Uint32 height,
+               Uint32 mipLevels)
+{
+    context->texture = create_texture_mipmapped(context, width, height, mipLevels);
+    
+    // Transfer buffer
+    context->transferBufferTexture =
+        SDL_CreateGPUTransferBuffer(context->device,
+                                    &(SDL_GPUTransferBufferCreateInfo)
+                                    {
+                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                        width * height * sizeof(Uint32)
+                                    });
+}
+
+SDL_GPUSampler *
+create_sampler(Context *context,
+               SDL_GPUFilter filter,
+               SDL_GPUSamplerMipmapMode mipmapMode,
+               float maxLod,
+               float maxAnisotropy)
+{
+    return SDL_CreateGPUSampler(context->device,
+                                &(SDL_GPUSamplerCreateInfo)
+                                {
+                                    filter, // min filter
+                                    filter, // mag filter
+                                    mipmapMode,
+                                    SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
+                                    SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
+                                    SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
+                                    0, // mip lod bias
+                                    maxAnisotropy,
+                                    SDL_GPU_COMPAREOP_GREATER,
+                                    0, // min lod
+                                    maxLod,
+                                    maxAnisotropy > 1.0f, // enable anisotropic
+                                    false // enable compare
+                                });
+}
+
+void
+create_samplers(Context *context)
+{
+    // Point and linear only ever read the top level, so pixel art stays
+    // crisp even on mipmapped textures
+    context->samplers[SAMPLER_POINT] =
+        create_sampler(context,
+                       SDL_GPU_FILTER_NEAREST,
+                       SDL_GPU_SAMPLERMIPMAPMODE_NEAREST,
+                       0, // max lod
+                       0); // max anisotropy
+    
+    context->samplers[SAMPLER_LINEAR] =
+        create_sampler(context,
+                       SDL_GPU_FILTER_LINEAR,
+                       SDL_GPU_SAMPLERMIPMAPMODE_NEAREST,
+                       0, // max lod
+                       0); // max anisotropy
+    
+    // Minified sprites read from the smaller levels instead
+    context->samplers[SAMPLER_TRILINEAR] =
+        create_sampler(context,
+                       SDL_GPU_FILTER_LINEAR,
+                       SDL_GPU_SAMPLERMIPMAPMODE_LINEAR,
+                       1000.0f, // max lod
+                       0); // max anisotropy
+    
+    context->samplers[SAMPLER_ANISOTROPIC] =
+        create_sampler(context,
+                       SDL_GPU_FILTER_LINEAR,
+                       SDL_GPU_SAMPLERMIPMAPMODE_LINEAR,
+                       1000.0f, // max lod
+                       8.0f); // max anisotropy
+    
+    // Not every device supports anisotropy, fall back to trilinear
+    if (!context->samplers[SAMPLER_ANISOTROPIC])
+    {
+        SDL_Log("%s", SDL_GetError());
+        context->samplers[SAMPLER_ANISOTROPIC] =
+            create_sampler(context,
+                           SDL_GPU_FILTER_LINEAR,
+                           SDL_GPU_SAMPLERMIPMAPMODE_LINEAR,
+                           1000.0f, // max lod
+                           0); // max anisotropy
+    }
+    
+    for (int i = 0; i < SAMPLER_COUNT; ++i)
+    {
+        assert(context->samplers[i]);
+    }
+}
+
+void
+update_texture(Context *context,
+               SDL_GPUTexture *texture,
+               SDL_GPUTransferBuffer *transfer,
+               Uint32 width, Uint32 height,
+               Uint32 mipLevels,
+               void *data)
+{
+    Uint64 zone = trace_begin(&context->tracer);
+    
+    // Map and copy texture data to GPU
+    Uint32* destData = upload_queue_map(context, transfer);
+    memcpy(destData, data, width * height * sizeof(Uint32));
+    SDL_UnmapGPUTransferBuffer(context->device, transfer);
+    
+    // Queue the upload, it is recorded with the next frame
+    upload_queue_push(context,
+                      (PendingUpload)
+                      {
+                          .transfer = transfer,
+                          .transferOffset = 0,
+                          .texture = texture,
+                          .width = width,
+                          .height = height,
+                          .cycle = true
+                      });
+    
+    // Only level 0 is uploaded, the rest are built from it
+    if (mipLevels > 1)
+    {
+        upload_queue_generate_mipmaps(context, texture);
+    }
+    
+    trace_end(&context->tracer, "update_texture", zone);
+}
+
+Skyline
+skyline_create(Uint32 width, Uint32 height)
+{
+    Skyline result = {0};
+    result.width = width;
+    result.height = height;
+    
+    // Every node is at least a pixel wide, plus one while inserting
+    result.maxNodeCount = width + 1;
+    result.nodes = SDL_malloc(result.maxNodeCount * sizeof(SkylineNode));
+    assert(result.nodes);
+    
+    result.nodes[0] = (SkylineNode){ 0, 0, width };
+    result.nodeCount = 1;
+    
+    return result;
+}
+
+bool
+skyline_fit(Skyline *skyline,
+            Uint32 nodeIndex,
+            Uint32 width, Uint32 height,
+            Uint32 *outY)
+{
+    // The rect rests on the highest node it spans
+    Uint32 x = skyline->nodes[nodeIndex].x;
+    if (x + width > skyline->width) return false;
+    
+    Uint32 y = 0;
+    Uint32 widthLeft = width;
+    for (Uint32 i = nodeIndex; widthLeft > 0; ++i)
+    {
+        assert(i < skyline->nodeCount);
+        y = SDL_max(y, skyline->nodes[i].y);
+        if (y + height > skyline->height) return false;
+        widthLeft -= SDL_min(widthLeft, skyline->nodes[i].width);
+    }
+    
+    *outY = y;
+    return true;
+}
+
+bool
+skyline_pack(Skyline *skyline,
+             Uint32 width, Uint32 height,
+             Uint32 *outX, Uint32 *outY)
+{
+    // Bottom-left: lowest top edge wins, narrowest node breaks ties
+    Uint32 bestIndex = 0xFFFFFFFF;
+    Uint32 bestTop = 0xFFFFFFFF;
+    Uint32 bestWidth = 0xFFFFFFFF;
+    Uint32 bestY = 0;
+    
+    for (Uint32 i = 0; i < skyline->nodeCount; ++i)
+    {
+        Uint32 y;
+        if (skyline_fit(skyline, i, width, height, &y))
+        {
+            Uint32 top = y + height;
+            if (top < bestTop ||
+                (top == bestTop && skyline->nodes[i].width < bestWidth))
+            {
+                bestIndex = i;
+                bestTop = top;
+                bestWidth = skyline->nodes[i].width;
+                bestY = y;
+            }
+        }
+    }
+    
+    if (bestIndex == 0xFFFFFFFF) return false;
+    
+    // Insert the new segment on top of the rect
+    SkylineNode *nodes = skyline->nodes;
+    assert(skyline->nodeCount < skyline->maxNodeCount);
+    SDL_memmove(nodes + bestIndex + 1,
+                nodes + bestIndex,
+                (skyline->nodeCount - bestIndex) * sizeof(SkylineNode));
+    nodes[bestIndex] = (SkylineNode){ nodes[bestIndex].x, bestY + height, width };
+    skyline->nodeCount++;
+    
+    *outX = nodes[bestIndex].x;
+    *outY = bestY;
+    
+    // Trim or remove the segments it now covers
+    for (Uint32 i = bestIndex + 1; i < skyline->nodeCount; ++i)
+    {
+        SkylineNode *prev = nodes + i - 1;
+        SkylineNode *node = nodes + i;
+        Uint32 prevEnd = prev->x + prev->width;
+        
+        if (node->x >= prevEnd) break;
+        
+        Uint32 shrink = prevEnd - node->x;
+        if (node->width <= shrink)
+        {
+            SDL_memmove(nodes + i,
+                        nodes + i + 1,
+                        (skyline->nodeCount - i - 1) * sizeof(SkylineNode));
+            skyline->nodeCount--;
+            i--;
+        }
+        else
+        {
+            node->x += shrink;
+            node->width -= shrink;
+            break;
+        }
+    }
+    
+    // Merge neighbours at the same height
+    for (Uint32 i = 0; i + 1 < skyline->nodeCount;)
+    {
+        if (nodes[i].y == nodes[i + 1].y)
+        {
+            nodes[i].width += nodes[i + 1].width;
+            SDL_memmove(nodes + i + 1,
+                        nodes + i + 2,
+                        (skyline->nodeCount - i - 2) * sizeof(SkylineNode));
+            skyline->nodeCount--;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    
+    return true;
+}
+
+SDL_GPUTexture *
+create_atlas_texture(Context *context, Uint32 width, Uint32 height)
+{
+    return SDL_CreateGPUTexture(context->device,
+                                &(SDL_GPUTextureCreateInfo)
+                                {
+                                    SDL_GPU_TEXTURETYPE_2D,
+                                    SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM,
+                                    SDL_GPU_TEXTUREUSAGE_SAMPLER,
+                                    width,
+                                    height,
+                                    1, // layer count
+                                    1, // mip levels
+                                    SDL_GPU_SAMPLECOUNT_1
+                                });
+}
+
+TextureAtlas
+create_atlas(Context *context,
+             Uint32 width, Uint32 height,
+             Uint32 maxRegionCount)
+{
+    TextureAtlas result = {0};
+    result.width = width;
+    result.height = height;
+    result.texture = create_atlas_texture(context, width, height);
+    result.skyline = skyline_create(width, height);
+    
+    result.maxRegionCount = maxRegionCount;
+    result.regions = SDL_calloc(maxRegionCount, sizeof(AtlasRegion));
+    assert(result.regions);
+    
+    // Enough staging to refill the whole atlas between two flushes
+    result.transferSize = width * height * sizeof(Uint32);
+    result.transfer =
+        SDL_CreateGPUTransferBuffer(context->device,
+                                    &(SDL_GPUTransferBufferCreateInfo)
+                                    {
+                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                        result.transferSize
+                                    });
+    
+    return result;
+}
+
+void
+release_atlas(Context *context,
+              TextureAtlas *atlas)
+{
+    SDL_ReleaseGPUTexture(context->device, atlas->texture);
+    SDL_ReleaseGPUTransferBuffer(context->device, atlas->transfer);
+    SDL_free(atlas->skyline.nodes);
+    SDL_free(atlas->regions);
+}
+
+void
+atlas_set_region(TextureAtlas *atlas,
+                 AtlasRegion *region,
+                 Uint32 x, Uint32 y)
+{
+    region->x = x;
+    region->y = y;
+    region->u0 = (float)x / atlas->width;
+    region->v0 = (float)y / atlas->height;
+    region->u1 = (float)(x + region->width) / atlas->width;
+    region->v1 = (float)(y + region->height) / atlas->height;
+}
+
+typedef struct
+{
+    Uint32 regionIndex;
+    Uint32 height;
+    
+} AtlasSortEntry;
+
+int
+atlas_sort_compare(const void *a, const void *b)
+{
+    // Tallest first packs tighter with a skyline
+    const AtlasSortEntry *entryA = a;
+    const AtlasSortEntry *entryB = b;
+    if (entryA->height != entryB->height)
+    {
+        return (entryA->height > entryB->height) ? -1 : 1;
+    }
+    return (entryA->regionIndex < entryB->regionIndex) ? -1 : 1;
+}
+
+bool
+atlas_compact(Context *context,
+              TextureAtlas *atlas)
+{
+    // Repack everything still in use into a fresh skyline first, so
+    // nothing changes if it doesn't fit
+    AtlasSortEntry *entries =
+        SDL_malloc(SDL_max(atlas->regionCount, 1) * sizeof(AtlasSortEntry));
+    Uint32 *newX = SDL_malloc(SDL_max(atlas->regionCount, 1) * sizeof(Uint32));
+    Uint32 *newY = SDL_malloc(SDL_max(atlas->regionCount, 1) * sizeof(Uint32));
+    assert(entries && newX && newY);
+    
+    Uint32 entryCount = 0;
+    for (Uint32 i = 0; i < atlas->regionCount; ++i)
+    {
+        if (atlas->regions[i].used)
+        {
+            entries[entryCount++] = (AtlasSortEntry){ i, atlas->regions[i].height };
+        }
+    }
+    SDL_qsort(entries, entryCount, sizeof(AtlasSortEntry), atlas_sort_compare);
+    
+    Skyline skyline = skyline_create(atlas->width, atlas->height);
+    Uint32 packedArea = 0;
+    bool fits = true;
+    
+    for (Uint32 i = 0; i < entryCount && fits; ++i)
+    {
+        AtlasRegion *region = atlas->regions + entries[i].regionIndex;
+        Uint32 packedWidth = region->width + ATLAS_PADDING;
+        Uint32 packedHeight = region->height + ATLAS_PADDING;
+        
+        fits = skyline_pack(&skyline, packedWidth, packedHeight,
+                            newX + entries[i].regionIndex,
+                            newY + entries[i].regionIndex);
+        packedArea += packedWidth * packedHeight;
+    }
+    
+    if (fits)
+    {
+        // Copy every region across on the GPU, in the same copy pass as
+        // any uploads into the old texture that are still queued
+        SDL_GPUTexture *texture =
+            create_atlas_texture(context, atlas->width, atlas->height);
+        
+        for (Uint32 i = 0; i < entryCount; ++i)
+        {
+            AtlasRegion *region = atlas->regions + entries[i].regionIndex;
+            
+            upload_queue_push(context,
+                              (PendingUpload)
+                              {
+                                  .sourceTexture = atlas->texture,
+                                  .sourceX = region->x,
+                                  .sourceY = region->y,
+                                  .texture = texture,
+                                  .x = newX[entries[i].regionIndex],
+                                  .y = newY[entries[i].regionIndex],
+                                  .width = region->width,
+                                  .height = region->height
+                              });
+            
+            atlas_set_region(atlas, region,
+                             newX[entries[i].regionIndex],
+                             newY[entries[i].regionIndex]);
+        }
+        
+        upload_queue_retire_texture(context, atlas->texture);
+        atlas->texture = texture;
+        
+        SDL_free(atlas->skyline.nodes);
+        atlas->skyline = skyline;
+        atlas->packedArea = packedArea;
+        atlas->compactCount++;
+    }
+    else
+    {
+        SDL_free(skyline.nodes);
+    }
+    
+    SDL_free(entries);
+    SDL_free(newX);
+    SDL_free(newY);
+    
+    return fits;
+}
+
+Uint32
+atlas_add(Context *context,
+          TextureAtlas *atlas,
+          Uint32 width, Uint32 height,
+          void *data)
+{
+    // Reuse a free region slot if there is one
+    Uint32 regionIndex = 0;
+    while (regionIndex < atlas->regionCount && atlas->regions[regionIndex].used)
+    {
+        regionIndex++;
+    }
+    if (regionIndex == atlas->maxRegionCount) return ATLAS_INVALID_REGION;
+    
+    // Padding keeps filtering from bleeding into neighbours
+    Uint32 packedWidth = width + ATLAS_PADDING;
+    Uint32 packedHeight = height + ATLAS_PADDING;
+    
+    Uint32 x, y;
+    if (!skyline_pack(&atlas->skyline, packedWidth, packedHeight, &x, &y))
+    {
+        // The skyline can't reuse freed space, so compact when enough of
+        // it has been freed to make a difference and try again
+        Uint32 freeArea = atlas->packedArea - atlas->usedArea;
+        if (freeArea < packedWidth * packedHeight ||
+            !atlas_compact(context, atlas) ||
+            !skyline_pack(&atlas->skyline, packedWidth, packedHeight, &x, &y))
+        {
+            return ATLAS_INVALID_REGION;
+        }
+    }
+    
+    AtlasRegion *region = atlas->regions + regionIndex;
+    *region = (AtlasRegion){0};
+    region->width = width;
+    region->height = height;
+    region->used = true;
+    atlas_set_region(atlas, region, x, y);
+    
+    if (regionIndex == atlas->regionCount) atlas->regionCount++;
+    atlas->packedArea += packedWidth * packedHeight;
+    atlas->usedArea += packedWidth * packedHeight;
+    
+    // Staging is written front to back until the queue is flushed,
+    // after that the earlier data has been recorded and can be cycled
+    Uint32 dataSize = width * height * sizeof(Uint32);
+    if (atlas->transferFlushCount != context->uploads.flushCount)
+    {
+        atlas->transferUsed = 0;
+        atlas->transferFlushCount = context->uploads.flushCount;
+    }
+    
+    SDL_GPUTransferBuffer *transfer = atlas->transfer;
+    Uint32 transferOffset = atlas->transferUsed;
+    bool cycle = (atlas->transferUsed == 0);
+    
+    if (atlas->transferUsed + dataSize > atlas->transferSize)
+    {
+        // Lots of churn in one frame, use a one-off staging buffer
+        transfer =
+            SDL_CreateGPUTransferBuffer(context->device,
+                                        &(SDL_GPUTransferBufferCreateInfo)
+                                        {
+                                            SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                            dataSize
+                                        });
+        assert(transfer);
+        transferOffset = 0;
+        cycle = false;
+        upload_queue_retire_transfer(context, transfer);
+    }
+    else
+    {
+        atlas->transferUsed += dataSize;
+    }
+    
+    Uint8 *destData = SDL_MapGPUTransferBuffer(context->device, transfer, cycle);
+    memcpy(destData + transferOffset, data, dataSize);
+    SDL_UnmapGPUTransferBuffer(context->device, transfer);
+    
+    // Only this region is written, the rest of the atlas is kept
+    upload_queue_push(context,
+                      (PendingUpload)
+                      {
+                          .transfer = transfer,
+                          .transferOffset = transferOffset,
+                          .texture = atlas->texture,
+                          .x = x,
+                          .y = y,
+                          .width = width,
+                          .height = height
+                      });
+    
+    return regionIndex;
+}
+
+void
+atlas_remove(TextureAtlas *atlas,
+             Uint32 regionIndex)
+{
+    AtlasRegion *region = atlas->regions + regionIndex;
+    assert(regionIndex < atlas->regionCount && region->used);
+    
+    // The space is only reclaimed when the atlas is compacted
+    region->used = false;
+    atlas->usedArea -= (region->width + ATLAS_PADDING) * (region->height + ATLAS_PADDING);
+}
+
+int
+texture_streamer_worker(void *data)
+{
+    TextureStreamer *streamer = data;
+    
+    for (;;)
+    {
+        // Wait for something to load
+        SDL_LockMutex(streamer->mutex);
+        while (!streamer->quit && streamer->requestCount == 0)
+        {
+            SDL_WaitCondition(streamer->requestAvailable, streamer->mutex);
+        }
+        if (streamer->quit)
+        {
+            SDL_UnlockMutex(streamer->mutex);
+            break;
+        }
+        
+        StreamRequest request = streamer->requests[streamer->requestFirst];
+        streamer->requestFirst = (streamer->requestFirst + 1) % MAX_STREAM_REQUESTS;
+        streamer->requestCount--;
+        SDL_UnlockMutex(streamer->mutex);
+        
+        // Read and decode off the render thread, ARGB8888 has the same
+        // memory layout as the B8G8R8A8 textures
+        SDL_Surface *surface = 0;
+        SDL_Surface *loaded = SDL_LoadBMP(request.path);
+        if (loaded)
+        {
+            surface = SDL_ConvertSurface(loaded, SDL_PIXELFORMAT_ARGB8888);
+            SDL_DestroySurface(loaded);
+        }
+        
+        Uint32 rowSize = surface ? surface->w * sizeof(Uint32) : 0;
+        Uint32 dataSize = surface ? rowSize * surface->h : 0;
+        
+        // A row is the smallest piece that gets uploaded in one frame
+        if (!surface ||
+            dataSize > streamer->ringSize ||
+            rowSize > streamer->bytesPerFrame)
+        {
+            if (surface)
+            {
+                SDL_Log("Failed to stream %s: too large for the stream ring/budget",
+                        request.path);
+                SDL_DestroySurface(surface);
+            }
+            else
+            {
+                SDL_Log("Failed to stream %s: %s", request.path, SDL_GetError());
+            }
+            
+            SDL_LockMutex(streamer->mutex);
+            streamer->textures[request.handle].state = STREAM_FAILED;
+            SDL_UnlockMutex(streamer->mutex);
+            continue;
+        }
+        
+        // Reserve contiguous space in the ring, skipping the end of the
+        // ring if the image doesn't fit there
+        SDL_LockMutex(streamer->mutex);
+        
+        Uint64 start = 0;
+        for (;;)
+        {
+            Uint64 head = streamer->ringHead;
+            Uint32 offset = (Uint32)(head % streamer->ringSize);
+            if (offset + dataSize > streamer->ringSize)
+            {
+                head += streamer->ringSize - offset;
+            }
+            
+            bool fits = head + dataSize - streamer->ringTail <= streamer->ringSize;
+            bool slot = streamer->stagedCount < MAX_STREAM_STAGED;
+            if ((fits && slot) || streamer->quit)
+            {
+                start = head;
+                break;
+            }
+            
+            SDL_WaitCondition(streamer->ringSpaceAvailable, streamer->mutex);
+        }
+        
+        if (streamer->quit)
+        {
+            SDL_UnlockMutex(streamer->mutex);
+            SDL_DestroySurface(surface);
+            break;
+        }
+        
+        streamer->ringHead = start + dataSize;
+        
+        Uint32 stagedIndex =
+            (streamer->stagedFirst + streamer->stagedCount) % MAX_STREAM_STAGED;
+        streamer->staged[stagedIndex] = (StreamStaged)
+        {
+            request.handle,
+            start,
+            start + dataSize,
+            false // ready
+        };
+        streamer->stagedCount++;
+        
+        SDL_UnlockMutex(streamer->mutex);
+        
+        // Nobody else touches the reserved range until it's marked ready
+        Uint8 *dest = streamer->ring + start % streamer->ringSize;
+        for (int row = 0; row < surface->h; ++row)
+        {
+            memcpy(dest + row * rowSize,
+                   (Uint8 *)surface->pixels + row * surface->pitch,
+                   rowSize);
+        }
+        
+        SDL_LockMutex(streamer->mutex);
+        StreamedTexture *texture = streamer->textures + request.handle;
+        texture->width = surface->w;
+        texture->height = surface->h;
+        texture->state = STREAM_STAGED;
+        streamer->staged[stagedIndex].ready = true;
+        SDL_UnlockMutex(streamer->mutex);
+        
+        SDL_DestroySurface(surface);
+    }
+    
+    return 0;
+}
+
+void
+create_texture_streamer(Context *context,
+                        Uint32 ringSize,
+                        Uint32 bytesPerFrame)
+{
+    TextureStreamer *streamer = &context->streamer;
+    *streamer = (TextureStreamer){0};
+    
+    streamer->mutex = SDL_CreateMutex();
+    streamer->requestAvailable = SDL_CreateCondition();
+    streamer->ringSpaceAvailable = SDL_CreateCondition();
+    assert(streamer->mutex &&
+           streamer->requestAvailable &&
+           streamer->ringSpaceAvailable);
+    
+    streamer->ringSize = ringSize;
+    streamer->ring = SDL_malloc(ringSize);
+    assert(streamer->ring);
+    
+    streamer->bytesPerFrame = bytesPerFrame;
+    streamer->transfer =
+        SDL_CreateGPUTransferBuffer(context->device,
+                                    &(SDL_GPUTransferBufferCreateInfo)
+                                    {
+                                        SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                        bytesPerFrame
+                                    });
+    assert(streamer->transfer);
+    
+    // Leave a core for the render thread
+    int workerCount = SDL_GetNumLogicalCPUCores() - 1;
+    streamer->workerCount = SDL_clamp(workerCount, 1, MAX_STREAM_WORKERS);
+    
+    for (Uint32 i = 0; i < streamer->workerCount; ++i)
+    {
+        streamer->workers[i] = SDL_CreateThread(texture_streamer_worker,
+                                                "TextureStreamer",
+                                                streamer);
+        assert(streamer->workers[i]);
+    }
+}
+
+void
+release_texture_streamer(Context *context,
+                         TextureStreamer *streamer)
+{
+    SDL_LockMutex(streamer->mutex);
+    streamer->quit = true;
+    SDL_BroadcastCondition(streamer->requestAvailable);
+    SDL_BroadcastCondition(streamer->ringSpaceAvailable);
+    SDL_UnlockMutex(streamer->mutex);
+    
+    for (Uint32 i = 0; i < streamer->workerCount; ++i)
+    {
+        SDL_WaitThread(streamer->workers[i], 0);
+    }
+    
+    for (Uint32 i = 0; i < streamer->textureCount; ++i)
+    {
+        SDL_ReleaseGPUTexture(context->device, streamer->textures[i].texture);
+    }
+    
+    SDL_ReleaseGPUTransferBuffer(context->device, streamer->transfer);
+    SDL_free(streamer->ring);
+    SDL_DestroyCondition(streamer->requestAvailable);
+    SDL_DestroyCondition(streamer->ringSpaceAvailable);
+    SDL_DestroyMutex(streamer->mutex);
+}
+
+bool
+job_queue_push(JobSystem *system,
+               Uint32 queueIndex,
+               Job job)
+{
+    JobQueue *queue = system->queues + queueIndex;
+    
+    SDL_LockSpinlock(&queue->lock);
+    if (queue->bottom - queue->top == JOB_QUEUE_SIZE)
+    {
+        SDL_UnlockSpinlock(&queue->lock);
+        return false;
+    }
+    
+    queue->jobs[queue->bottom % JOB_QUEUE_SIZE] = job;
+    queue->bottom++;
+    
+    // Checked under the lock, so a worker about to sleep either finds
+    // this job when it looks again or is counted here and woken
+    bool wake = SDL_GetAtomicInt(&system->sleepingCount) > 0;
+    SDL_UnlockSpinlock(&queue->lock);
+    
+    if (wake)
+    {
+        SDL_SignalSemaphore(system->wake);
+    }
+    return true;
+}
+
+bool
+job_system_find(JobSystem *system,
+                Uint32 queueIndex,
+                Job *job)
+{
+    // Our own newest job first, its data is most likely still in cache
+    JobQueue *queue = system->queues + queueIndex;
+    SDL_LockSpinlock(&queue->lock);
+    bool found = queue->bottom != queue->top;
+    if (found)
+    {
+        queue->bottom--;
+        *job = queue->jobs[queue->bottom % JOB_QUEUE_SIZE];
+    }
+    SDL_UnlockSpinlock(&queue->lock);
+    if (found) return true;
+    
+    // Then steal the oldest, and so largest, range from another thread
+    Uint32 queueCount = system->workerCount + 1;
+    for (Uint32 i = 1; i < queueCount && !found; ++i)
+    {
+        queue = system->queues + (queueIndex + i) % queueCount;
+        SDL_LockSpinlock(&queue->lock);
+        found = queue->bottom != queue->top;
+        if (found)
+        {
+            *job = queue->jobs[queue->top % JOB_QUEUE_SIZE];
+            queue->top++;
+        }
+        SDL_UnlockSpinlock(&queue->lock);
+    }
+    
+    return found;
+}
+
+void
+job_execute(JobSystem *system,
+            Uint32 queueIndex,
+            Job job)
+{
+    // Keep halving the range, leaving the back half where idle threads
+    // can steal it, until what's left is small enough to run
+    while (job.count > job.grain)
+    {
+        Job back = job;
+        back.first = job.first + job.count / 2;
+        back.count = job.count - job.count / 2;
+        
+        SDL_AddAtomicInt(job.counter, 1);
+        if (!job_queue_push(system, queueIndex, back))
+        {
+            // Queue full, run the rest here
+            SDL_AddAtomicInt(job.counter, -1);
+            break;
+        }
+        job.count /= 2;
+    }
+    
+    job.function(job.data, job.first, job.count);
+    
+    // Makes what the job wrote visible to the thread waiting on the counter
+    SDL_AddAtomicInt(job.counter, -1);
+}
+
+int
+job_worker(void *data)
+{
+    JobWorker *worker = data;
+    JobSystem *system = worker->system;
+    
+    for (;;)
+    {
+        Job job;
+        if (job_system_find(system, worker->queueIndex, &job))
+        {
+            job_execute(system, worker->queueIndex, job);
+            continue;
+        }
+        
+        // Look once more after saying we're going to sleep, anything
+        // pushed in between is either found here or signals the semaphore
+        SDL_AddAtomicInt(&system->sleepingCount, 1);
+        bool found = job_system_find(system, worker->queueIndex, &job);
+        bool quit = SDL_GetAtomicInt(&system->quit);
+        if (!found && !quit)
+        {
+            SDL_WaitSemaphore(system->wake);
+        }
+        SDL_AddAtomicInt(&system->sleepingCount, -1);
+        
+        if (found)
+        {
+            job_execute(system, worker->queueIndex, job);
+        }
+        else if (quit)
+        {
+            break;
+        }
+    }
+    
+    return 0;
+}
+
+void
+create_job_system(JobSystem *system,
+                  int argc,
+                  char **argv)
+{
+    // --job-workers N overrides the worker count, with 0 every job runs
+    // on the thread that waits for it
+    *system = (JobSystem){0};
+    
+    // The waiting thread helps out, so it keeps a core of its own
+    int workerCount = SDL_GetNumLogicalCPUCores() - 1;
+    for (int i = 1; i < argc - 1; ++i)
+    {
+        if (SDL_strcmp(argv[i], "--job-workers") == 0)
+        {
+            workerCount = SDL_atoi(argv[i + 1]);
+        }
+    }
+    system->workerCount = SDL_clamp(workerCount, 0, MAX_JOB_WORKERS);
+    
+    system->wake = SDL_CreateSemaphore(0);
+    assert(system->wake);
+    
+    for (Uint32 i = 0; i < system->workerCount; ++i)
+    {
+        JobWorker *worker = system->workers + i;
+        worker->system = system;
+        worker->queueIndex = i + 1;
+        worker->thread = SDL_CreateThread(job_worker, "JobWorker", worker);
+        assert(worker->thread);
+    }
+}
+
+void
+release_job_system(JobSystem *system)
+{
+    SDL_SetAtomicInt(&system->quit, 1);
+    for (Uint32 i = 0; i < system->workerCount; ++i)
+    {
+        SDL_SignalSemaphore(system->wake);
+    }
+    
+    for (Uint32 i = 0; i < system->workerCount; ++i)
+    {
+        SDL_WaitThread(system->workers[i].thread, 0);
+    }
+    
+    SDL_DestroySemaphore(system->wake);
+}
+
+void
+job_system_run(JobSystem *system,
+               JobFunction function,
+               void *data,
+               Uint32 count,
+               Uint32 grain,
+               SDL_AtomicInt *counter)
+{
+    // Only called from the thread that waits, which owns queue 0. The
+    // workers steal the range and split it between themselves.
+    Job job = { function, data, 0, count, SDL_max(grain, 1), counter };
+    
+    SDL_AddAtomicInt(counter, 1);
+    if (!job_queue_push(system, 0, job))
+    {
+        job_execute(system, 0, job);
+    }
+}
+
+void
+job_system_wait(JobSystem *system,
+                SDL_AtomicInt *counter)
+{
+    // Run jobs instead of blocking, until the ones still on a worker finish
+    while (SDL_GetAtomicInt(counter) > 0)
+    {
+        Job job;
+        if (job_system_find(system, 0, &job))
+        {
+            job_execute(system, 0, job);
+        }
+        else
+        {
+            SDL_CPUPauseInstruction();
+        }
+    }
+}
+
+Uint32
+texture_stream_request(TextureStreamer *streamer,
+                       const char *path)
+{
+    if (streamer->textureCount == MAX_STREAMED_TEXTURES)
+    {
+        return STREAM_INVALID_HANDLE;
+    }
+    
+    SDL_LockMutex(streamer->mutex);
+    
+    if (streamer->requestCount == MAX_STREAM_REQUESTS)
+    {
+        SDL_UnlockMutex(streamer->mutex);
+        return STREAM_INVALID_HANDLE;
+    }
+    
+    Uint32 handle = streamer->textureCount++;
+    streamer->textures[handle] = (StreamedTexture){0};
+    
+    StreamRequest *request =
+        streamer->requests +
+        (streamer->requestFirst + streamer->requestCount) % MAX_STREAM_REQUESTS;
+    SDL_strlcpy(request->path, path, sizeof(request->path));
+    request->handle = handle;
+    streamer->requestCount++;
+    
+    SDL_SignalCondition(streamer->requestAvailable);
+    SDL_UnlockMutex(streamer->mutex);
+    
+    return handle;
+}
+
+SDL_GPUTexture *
+texture_stream_get(TextureStreamer *streamer,
+                   Uint32 handle,
+                   SDL_GPUTexture *placeholder)
+{
+    if (handle >= streamer->textureCount) return placeholder;
+    
+    // Workers write the state of loads that are staged or failed
+    StreamedTexture *texture = streamer->textures + handle;
+    SDL_LockMutex(streamer->mutex);
+    bool resident = texture->state == STREAM_RESIDENT;
+    SDL_UnlockMutex(streamer->mutex);
+    
+    return resident ? texture->texture : placeholder;
+}
+
+bool
+texture_streamer_busy(TextureStreamer *streamer)
+{
+    // True while any texture is still on its way to being resident
+    bool busy = false;
+    SDL_LockMutex(streamer->mutex);
+    for (Uint32 i = 0; i < streamer->textureCount && !busy; ++i)
+    {
+        StreamState state = streamer->textures[i].state;
+        busy = (state == STREAM_QUEUED || state == STREAM_STAGED);
+    }
+    SDL_UnlockMutex(streamer->mutex);
+    return busy;
+}
+
+void
+texture_streamer_update(Context *context,
+                        TextureStreamer *streamer)
+{
+    // Called once per frame before the upload queue is flushed, the
+    // transfer buffer is cycled on the first write of every frame
+    Uint8 *transferData = 0;
+    Uint32 used = 0;
+    
+    for (;;)
+    {
+        SDL_LockMutex(streamer->mutex);
+        bool ready = (streamer->stagedCount > 0 &&
+                      streamer->staged[streamer->stagedFirst].ready);
+        StreamStaged staged = streamer->staged[streamer->stagedFirst];
+        SDL_UnlockMutex(streamer->mutex);
+        
+        // Keep ring order so the space can be handed back in one piece
+        if (!ready) break;
+        
+        StreamedTexture *texture = streamer->textures + staged.handle;
+        Uint32 rowSize = texture->width * sizeof(Uint32);
+        
+        Uint32 rowCount = SDL_min(texture->height - texture->rowsUploaded,
+                                  (streamer->bytesPerFrame - used) / rowSize);
+        if (rowCount == 0) break;
+        
+        if (!texture->texture)
+        {
+            texture->texture =
+                create_texture_mipmapped(context,
+                                         texture->width,
+                                         texture->height,
+                                         texture_mip_count(texture->width,
+                                                           texture->height));
+            assert(texture->texture);
+        }
+        
+        if (!transferData)
+        {
+            transferData = SDL_MapGPUTransferBuffer(context->device,
+                                                    streamer->transfer,
+                                                    true); // cycle
+            assert(transferData);
+        }
+        
+        Uint32 size = rowCount * rowSize;
+        Uint8 *source = streamer->ring +
+                        staged.start % streamer->ringSize +
+                        texture->rowsUploaded * rowSize;
+        memcpy(transferData + used, source, size);
+        
+        // Large images are split into bands over several frames
+        upload_queue_push(context,
+                          (PendingUpload)
+                          {
+                              .transfer = streamer->transfer,
+                              .transferOffset = used,
+                              .texture = texture->texture,
+                              .y = texture->rowsUploaded,
+                              .width = texture->width,
+                              .height = rowCount
+                          });
+        
+        used += size;
+        texture->rowsUploaded += rowCount;
+        
+        if (texture->rowsUploaded == texture->height)
+        {
+            // The copy and the mips are queued before any draw that
+            // could see this
+            upload_queue_generate_mipmaps(context, texture->texture);
+            
+            SDL_LockMutex(streamer->mutex);
+            texture->state = STREAM_RESIDENT;
+            streamer->ringTail = staged.end;
+            streamer->stagedFirst = (streamer->stagedFirst + 1) % MAX_STREAM_STAGED;
+            streamer->stagedCount--;
+            SDL_BroadcastCondition(streamer->ringSpaceAvailable);
+            SDL_UnlockMutex(streamer->mutex);
+        }
+    }
+    
+    if (transferData)
+    {
+        SDL_UnmapGPUTransferBuffer(context->device, streamer->transfer);
+    }
+    
+    streamer->bytesUploaded += used;
+}
+
+void
+render_pass(Context *context,
+            SDL_GPUCommandBuffer* cmdbuf,
+            SDL_GPUGraphicsPipeline *pipeline,
+            SDL_GPUTexture *texture,
+            SamplerType sampler,
+            RenderTarget target,
+            RenderBuffers *buffers,
+            BatchDraw *draws,
+            Uint32 drawCount,
+            float matrix[],
+            float postProcessData[])
+{
+    Uint64 zone = trace_begin(&context->tracer);
+    
+    // Setup the color target
+    SDL_GPUColorTargetInfo colorTargetInfo = { 0 };
+    colorTargetInfo.texture = target.texture;
+    colorTargetInfo.clear_color = target.clearColor;
+    colorTargetInfo.load_op = target.loadOp;
+    colorTargetInfo.store_op = target.storeOp;
+    colorTargetInfo.cycle = target.cycle;
+    
+    // Begin a render pass
+    SDL_GPURenderPass* renderPass =
+        SDL_BeginGPURenderPass(cmdbuf, &colorTargetInfo, 1, NULL);
+    
+    if (target.viewportWidth)
+    {
+        SDL_SetGPUViewport(renderPass,
+                           &(SDL_GPUViewport)
+                           {
+                               0, 0,
+                               (float)target.viewportWidth,
+                               (float)target.viewportHeight,
+                               0.0f, 1.0f
+                           });
+        SDL_SetGPUScissor(renderPass,
+                          &(SDL_Rect)
+                          {
+                              0, 0,
+                              target.viewportWidth,
+                              target.viewportHeight
+                          });
+    }
+    
+    if (matrix)
+    {
+        SDL_PushGPUVertexUniformData(cmdbuf,
+                                     0,
+                                     matrix,
+                                     sizeof(float) * 16);
+    }
+    
+    if (postProcessData)
+    {
+        SDL_PushGPUFragmentUniformData(cmdbuf,
+                                       0,
+                                       postProcessData,
+                                       sizeof(float) * 8);
+    }
+    
+    // Bind our graphics pipeline, batch draws bind their own
+    if (pipeline)
+    {
+        SDL_BindGPUGraphicsPipeline(renderPass, pipeline);
+    }
+    
+    // Texture and Sampler
+    if (texture)
+    {
+        SDL_BindGPUFragmentSamplers(renderPass,
+                                    0, // first slot
+                                    &(SDL_GPUTextureSamplerBinding)
+                                    {
+                                        texture,
+                                        context->samplers[sampler]
+                                    },
+                                    1);
+    }
+    
+    if (buffers)
+    {
+        SDL_BindGPUVertexBuffers(renderPass, 0,
+                                 &(SDL_GPUBufferBinding){ buffers->vertex, 0 },
+                                 1);
+        
+        SDL_BindGPUIndexBuffer(renderPass,
+                               &(SDL_GPUBufferBinding){ buffers->index, 0 },
+                               buffers->indexElementSize);
+        
+        if (draws)
+        {
+            // Only rebind state when it actually changes between draws
+            SDL_GPUGraphicsPipeline *boundPipeline = pipeline;
+            SDL_GPUTexture *boundTexture = texture;
+            SamplerType boundSampler = sampler;
+            
+            for (Uint32 drawIndex = 0; drawIndex < drawCount; ++drawIndex)
+            {
+                BatchDraw *draw = draws + drawIndex;
+                
+                if (draw->instanceStride)
+                {
+                    // Offset the binding rather than passing first_instance,
+                    // which isn't handled the same way by every backend
+                    SDL_BindGPUVertexBuffers(renderPass, 0,
+                                             &(SDL_GPUBufferBinding)
+                                             {
+                                                 buffers->vertex,
+                                                 draw->firstInstance * draw->instanceStride
+                                             },
+                                             1);
+                }
+                
+                if (draw->pipeline != boundPipeline)
+                {
+                    SDL_BindGPUGraphicsPipeline(renderPass, draw->pipeline);
+                    boundPipeline = draw->pipeline;
+                }
+                
+                if (draw->texture != boundTexture ||
+                    draw->sampler != boundSampler)
+                {
+                    SDL_BindGPUFragmentSamplers(renderPass,
+                                                0, // first slot
+                                                &(SDL_GPUTextureSamplerBinding)
+                                                {
+                                                    draw->texture,
+                                                    context->samplers[draw->sampler]
+                                                },
+                                                1);
+                    boundTexture = draw->texture;
+                    boundSampler = draw->sampler;
+                }
+                
+                if (draw->indirect)
+                {
+                    // Counts come from the GPU, the CPU never sees them
+                    SDL_DrawGPUIndexedPrimitivesIndirect(renderPass,
+                                                         draw->indirect,
+                                                         0, // offset
+                                                         1); // draw count
+                }
+                else if (draw->instanceStride)
+                {
+                    // One quad per instance, the vertex shader places it
+                    SDL_DrawGPUIndexedPrimitives(renderPass,
+                                                 6, draw->instanceCount,
+                                                 0, 0, 0);
+                }
+                else
+                {
+                    SDL_DrawGPUIndexedPrimitives(renderPass,
+                                                 draw->indexCount, 1,
+                                                 draw->firstIndex, 0, 0);
+                }
+            }
+        }
+        else if (pipeline)
+        {
+            SDL_DrawGPUIndexedPrimitives(renderPass, buffers->indexCount, 1, 0, 0, 0);
+        }
+    }
+    else if (pipeline)
+    {
+        // Assume it's a post-process which has in-shader vertices
+        SDL_DrawGPUPrimitives(renderPass, 6, 1, 0, 0);
+    }
+    
+    // End the render pass. With neither a pipeline nor buffers nothing was
+    // drawn, the pass only clears the target.
+    SDL_EndGPURenderPass(renderPass);
+    trace_end(&context->tracer, "render_pass", zone);
+}
+
+SDL_GPUTexture *
+target_pool_acquire(Context *context,
+                    TargetPool *pool,
+                    Uint32 width, Uint32 height,
+                    SDL_GPUTextureFormat format,
+                    SDL_GPUTextureUsageFlags usage,
+                    Uint32 *outWidth, Uint32 *outHeight)
+{
+    // Callers draw into the top left and get the real size back
+    width = (width + TARGET_POOL_BUCKET - 1) / TARGET_POOL_BUCKET * TARGET_POOL_BUCKET;
+    height = (height + TARGET_POOL_BUCKET - 1) / TARGET_POOL_BUCKET * TARGET_POOL_BUCKET;
+    *outWidth = width;
+    *outHeight = height;
+    
+    // Anything free with the same description will do
+    for (Uint32 i = 0; i < pool->count; ++i)
+    {
+        PooledTarget *target = pool->targets + i;
+        if (!target->inUse &&
+            target->width == width &&
+            target->height == height &&
+            target->format == format &&
+            target->usage == usage)
+        {
+            target->inUse = true;
+            target->lastUsedFrame = context->frameIndex;
+            return target->texture;
+        }
+    }
+    
+    // When full, make room by dropping the free target unused the longest
+    PooledTarget *target = 0;
+    if (pool->count < MAX_POOLED_TARGETS)
+    {
+        target = pool->targets + pool->count++;
+    }
+    else
+    {
+        for (Uint32 i = 0; i < pool->count; ++i)
+        {
+            PooledTarget *candidate = pool->targets + i;
+            if (!candidate->inUse &&
+                (!target || candidate->lastUsedFrame < target->lastUsedFrame))
+            {
+                target = candidate;
+            }
+        }
+        
+        // Every slot in use means a frame needs more targets than exist
+        assert(target);
+        SDL_ReleaseGPUTexture(context->device, target->texture);
+    }
+    
+    *target = (PooledTarget)
+    {
+        SDL_CreateGPUTexture(context->device,
+                             &(SDL_GPUTextureCreateInfo)
+                             {
+                                 SDL_GPU_TEXTURETYPE_2D,
+                                 format,
+                                 usage,
+                                 width,
+                                 height,
+                                 1, // layer count
+                                 1, // mip levels
+                                 SDL_GPU_SAMPLECOUNT_1
+                             }),
+        width,
+        height,
+        format,
+        usage,
+        true, // in use
+        context->frameIndex
+    };
+    assert(target->texture);
+    
+    return target->texture;
+}
+
+void
+target_pool_release(TargetPool *pool,
+                    SDL_GPUTexture *texture)
+{
+    // Free for the next acquire, SDL keeps it alive while the GPU uses it
+    for (Uint32 i = 0; i < pool->count; ++i)
+    {
+        if (pool->targets[i].texture == texture)
+        {
+            assert(pool->targets[i].inUse);
+            pool->targets[i].inUse = false;
+            return;
+        }
+    }
+    assert(!"Texture is not from this pool");
+}
+
+void
+target_pool_trim(Context *context,
+                 TargetPool *pool,
+                 Uint32 maxUnusedFrames)
+{
+    for (Uint32 i = 0; i < pool->count;)
+    {
+        PooledTarget *target = pool->targets + i;
+        if (!target->inUse &&
+            context->frameIndex - target->lastUsedFrame > maxUnusedFrames)
+        {
+            SDL_ReleaseGPUTexture(context->device, target->texture);
+            *target = pool->targets[--pool->count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+void
+release_target_pool(Context *context,
+                    TargetPool *pool)
+{
+    for (Uint32 i = 0; i < pool->count; ++i)
+    {
+        SDL_ReleaseGPUTexture(context->device, pool->targets[i].texture);
+    }
+    *pool = (TargetPool){0};
+}
+
+void
+render_graph_begin(RenderGraph *graph)
+{
+    *graph = (RenderGraph){0};
+}
+
+Uint32
+render_graph_import(RenderGraph *graph,
+                    const char *name,
+                    SDL_GPUTexture *texture,
+                    bool output)
+{
+    // Outputs are kept at the end of the frame, like the swapchain
+    assert(graph->resourceCount < MAX_RENDER_GRAPH_RESOURCES);
+    Uint32 index = graph->resourceCount++;
+    graph->resources[index] = (RenderGraphResource)
+    {
+        .name = name,
+        .texture = texture,
+        .imported = true,
+        .output = output
+    };
+    return index;
+}
+
+Uint32
+render_graph_transient(RenderGraph *graph,
+                       const char *name,
+                       Uint32 width, Uint32 height,
+                       SDL_GPUTextureFormat format,
+                       SDL_GPUTextureUsageFlags usage)
+{
+    assert(graph->resourceCount < MAX_RENDER_GRAPH_RESOURCES);
+    Uint32 index = graph->resourceCount++;
+    graph->resources[index] = (RenderGraphResource)
+    {
+        .name = name,
+        .width = width,
+        .height = height,
+        .format = format,
+        .usage = usage
+    };
+    return index;
+}
+
+Uint32
+render_graph_add_pass(RenderGraph *graph,
+                      const char *name,
+                      Uint32 write,
+                      RenderGraphWriteMode writeMode,
+                      SDL_FColor clearColor)
+{
+    assert(!graph->compiled);
+    assert(graph->passCount < MAX_RENDER_GRAPH_PASSES);
+    assert(write < graph->resourceCount);
+    
+    Uint32 index = graph->passCount++;
+    graph->passes[index] = (RenderGraphPass)
+    {
+        .name = name,
+        .write = write,
+        .writeMode = writeMode,
+        .clearColor = clearColor
+    };
+    return index;
+}
+
+void
+render_graph_read(RenderGraph *graph,
+                  Uint32 passIndex,
+                  Uint32 resource)
+{
+    RenderGraphPass *pass = graph->passes + passIndex;
+    assert(pass->readCount < MAX_RENDER_GRAPH_READS);
+    assert(resource < graph->resourceCount);
+    pass->reads[pass->readCount++] = resource;
+}
+
+void
+render_graph_compile(RenderGraph *graph)
+{
+    // Walk back from the outputs. A pass is needed if something later
+    // needs what it writes, and then whatever it reads is needed too.
+    bool live[MAX_RENDER_GRAPH_RESOURCES] = {0};
+    for (Uint32 r = 0; r < graph->resourceCount; ++r)
+    {
+        live[r] = graph->resources[r].output;
+    }
+    
+    for (Uint32 p = graph->passCount; p-- > 0;)
+    {
+        RenderGraphPass *pass = graph->passes + p;
+        pass->culled = !live[pass->write];
+        if (pass->culled)
+        {
+            graph->culledPassCount++;
+            continue;
+        }
+        
+        // Earlier contents only matter if this pass draws on top of them
+        live[pass->write] = (pass->writeMode == RENDER_GRAPH_PRESERVE);
+        for (Uint32 i = 0; i < pass->readCount; ++i)
+        {
+            live[pass->reads[i]] = true;
+        }
+    }
+    
+    // Lifetimes of the transient targets over the passes that are left
+    for (Uint32 r = 0; r < graph->resourceCount; ++r)
+    {
+        graph->resources[r].firstPass = RENDER_GRAPH_NONE;
+        graph->resources[r].lastPass = RENDER_GRAPH_NONE;
+    }
+    
+    for (Uint32 p = 0; p < graph->passCount; ++p)
+    {
+        RenderGraphPass *pass = graph->passes + p;
+        if (pass->culled) continue;
+        
+        for (Uint32 i = 0; i <= pass->readCount; ++i)
+        {
+            Uint32 r = (i < pass->readCount) ? pass->reads[i] : pass->write;
+            RenderGraphResource *resource = graph->resources + r;
+            if (resource->firstPass == RENDER_GRAPH_NONE) resource->firstPass = p;
+            resource->lastPass = p;
+        }
+    }
+    
+    // Load what's already there only when it's been drawn this frame or
+    // comes from outside, and store only what a later pass or the
+    // outside world looks at
+    for (Uint32 p = 0; p < graph->passCount; ++p)
+    {
+        RenderGraphPass *pass = graph->passes + p;
+        if (pass->culled) continue;
+        
+        RenderGraphResource *resource = graph->resources + pass->write;
+        bool hasContents = resource->imported || resource->firstPass != p;
+        
+        SDL_GPULoadOp loadOp = SDL_GPU_LOADOP_DONT_CARE;
+        if (pass->writeMode == RENDER_GRAPH_CLEAR)
+        {
+            loadOp = SDL_GPU_LOADOP_CLEAR;
+        }
+        else if (pass->writeMode == RENDER_GRAPH_PRESERVE && hasContents)
+        {
+            loadOp = SDL_GPU_LOADOP_LOAD;
+        }
+        
+        bool usedLater = resource->output;
+        for (Uint32 later = p + 1; later < graph->passCount && !usedLater; ++later)
+        {
+            RenderGraphPass *laterPass = graph->passes + later;
+            if (laterPass->culled) continue;
+            
+            for (Uint32 i = 0; i < laterPass->readCount; ++i)
+            {
+                if (laterPass->reads[i] == pass->write) usedLater = true;
+            }
+            
+            // A later full write means nothing here survives to be used
+            if (laterPass->write == pass->write)
+            {
+                if (laterPass->writeMode == RENDER_GRAPH_PRESERVE) usedLater = true;
+                else break;
+            }
+        }
+        
+        pass->target = (RenderTarget)
+        {
+            resource->texture,
+            loadOp,
+            usedLater ? SDL_GPU_STOREOP_STORE : SDL_GPU_STOREOP_DONT_CARE,
+            pass->clearColor,
+            
+            // The swapchain can't cycle, transient targets can whenever
+            // nothing is loaded
+            !resource->imported && loadOp != SDL_GPU_LOADOP_LOAD
+        };
+        
+        if (loadOp == SDL_GPU_LOADOP_LOAD) graph->loadCount++;
+        if (usedLater) graph->storeCount++;
+    }
+    
+    graph->compiled = true;
+}
+
+bool
+render_graph_pass_begin(Context *context,
+                        RenderGraph *graph,
+                        Uint32 passIndex)
+{
+    // Returns false for culled or undeclared passes, which must not be
+    // recorded
+    assert(graph->compiled);
+    if (passIndex == RENDER_GRAPH_NONE) return false;
+    RenderGraphPass *pass = graph->passes + passIndex;
+    if (pass->culled) return false;
+    
+    // Transients get a texture from the pool on first use, which may be
+    // one that an earlier pass this frame has finished with
+    for (Uint32 r = 0; r < graph->resourceCount; ++r)
+    {
+        RenderGraphResource *resource = graph->resources + r;
+        if (!resource->imported && resource->firstPass == passIndex)
+        {
+            resource->texture = target_pool_acquire(context,
+                                                    &context->targetPool,
+                                                    resource->width,
+                                                    resource->height,
+                                                    resource->format,
+                                                    resource->usage,
+                                                    &resource->textureWidth,
+                                                    &resource->textureHeight);
+        }
+    }
+    
+    pass->target.texture = graph->resources[pass->write].texture;
+    return true;
+}
+
+RenderTarget
+render_graph_scaled_target(RenderGraph *graph,
+                           Uint32 passIndex,
+                           Uint32 viewportWidth,
+                           Uint32 viewportHeight)
+{
+    // The pass's target limited to a viewport in its top left
+    RenderTarget result = graph->passes[passIndex].target;
+    result.viewportWidth = viewportWidth;
+    result.viewportHeight = viewportHeight;
+    return result;
+}
+
+SDL_GPUTexture *
+render_graph_texture(RenderGraph *graph,
+                     Uint32 resource)
+{
+    // Only valid inside a pass that uses the resource
+    assert(graph->resources[resource].texture);
+    return graph->resources[resource].texture;
+}
+
+void
+render_graph_pass_end(Context *context,
+                      RenderGraph *graph,
+                      Uint32 passIndex)
+{
+    // Hand back transients nothing later in the frame uses
+    for (Uint32 r = 0; r < graph->resourceCount; ++r)
+    {
+        RenderGraphResource *resource = graph->resources + r;
+        if (!resource->imported && resource->lastPass == passIndex)
+        {
+            target_pool_release(&context->targetPool, resource->texture);
+            resource->texture = 0;
+        }
+    }
+}
+
+void
+dynamic_resolution_init(Context *context,
+                        int argc,
+                        char **argv)
+{
+    // --dynamic-resolution turns it on, called once the present mode and
+    // frame limit are settled
+    DynamicResolution *dr = &context->dynamicResolution;
+    *dr = (DynamicResolution){0};
+    dr->scale = 1.0f;
+    dr->minScale = 0.5f;
+    dr->maxScale = 1.0f;
+    dr->probeInterval = DYNAMIC_RESOLUTION_PROBE_FRAMES;
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], "--dynamic-resolution") == 0) dr->enabled = true;
+    }
+    
+    // The budget is a frame at the limit, or at the display's refresh rate
+    FramePacing *pacing = &context->pacing;
+    float refreshRate = 60.0f;
+    const SDL_DisplayMode *mode =
+        SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(context->window));
+    if (mode && mode->refresh_rate > 0.0f)
+    {
+        refreshRate = mode->refresh_rate;
+    }
+    if (pacing->frameLimit)
+    {
+        refreshRate = (float)pacing->frameLimit;
+    }
+    
+    dr->targetFrameTime = 1.0f / refreshRate;
+    dr->smoothedFrameTime = dr->targetFrameTime;
+    dr->capped = pacing->frameLimit ||
+        pacing->presentMode == SDL_GPU_PRESENTMODE_VSYNC;
+}
+
+void
+dynamic_resolution_update(DynamicResolution *dr,
+                          float frameTime)
+{
+    if (!dr->enabled)
+    {
+        dr->scale = 1.0f;
+        return;
+    }
+    
+    // The first frame also covers everything before the loop started
+    if (dr->frameCount++ == 0) return;
+    
+    // Smooth out single slow frames, then only step once the new scale
+    // has had a few frames to show up in the timings
+    dr->smoothedFrameTime += (frameTime - dr->smoothedFrameTime) * 0.1f;
+    dr->framesSinceChange++;
+    if (dr->framesSinceChange < 8) return;
+    
+    // Fill cost goes with the area, so correct by the square root of
+    // the ratio, and leave a band around the target so it settles
+    float ratio = dr->targetFrameTime / dr->smoothedFrameTime;
+    float newScale = dr->scale;
+    bool probe = false;
+    if (ratio < 0.95f)
+    {
+        newScale = dr->scale * SDL_sqrtf(ratio);
+        
+        if (dr->probing && dr->framesSinceChange < dr->probeInterval)
+        {
+            dr->probeInterval = SDL_min(dr->probeInterval * 2,
+                                        DYNAMIC_RESOLUTION_MAX_PROBE_FRAMES);
+        }
+    }
+    else if (ratio > 1.15f)
+    {
+        newScale = dr->scale * 1.05f;
+    }
+    else if (dr->capped && dr->framesSinceChange >= dr->probeInterval)
+    {
+        // On budget, but a capped frame time can't show any headroom
+        newScale = dr->scale + 1.0f / 32.0f;
+        probe = true;
+    }
+    
+    // Whole steps of 1/32 so small changes don't shimmer every frame
+    newScale = SDL_roundf(newScale * 32.0f) / 32.0f;
+    newScale = SDL_clamp(newScale, dr->minScale, dr->maxScale);
+    
+    if (newScale != dr->scale)
+    {
+        dr->scale = newScale;
+        dr->framesSinceChange = 0;
+        dr->probing = probe;
+    }
+}
+
+void
+frame_pacing_init(FramePacing *pacing,
+                  int argc,
+                  char **argv)
+{
+    // --present vsync|mailbox|immediate, --frames-in-flight 1-3,
+    // --no-wait for a non-blocking acquire, --fps N to limit the rate and
+    // --idle to only draw when something changed
+    *pacing = (FramePacing){0};
+    pacing->dirty = true;
+    pacing->presentMode = SDL_GPU_PRESENTMODE_VSYNC;
+    pacing->framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        char *value = (i + 1 < argc) ? argv[i + 1] : "";
+        
+        if (SDL_strcmp(argv[i], "--present") == 0)
+        {
+            if (SDL_strcmp(value, "mailbox") == 0) pacing->presentMode = SDL_GPU_PRESENTMODE_MAILBOX;
+            else if (SDL_strcmp(value, "immediate") == 0) pacing->presentMode = SDL_GPU_PRESENTMODE_IMMEDIATE;
+            else pacing->presentMode = SDL_GPU_PRESENTMODE_VSYNC;
+            ++i;
+        }
+        else if (SDL_strcmp(argv[i], "--frames-in-flight") == 0)
+        {
+            pacing->framesInFlight = SDL_clamp(SDL_atoi(value), 1, 3);
+            ++i;
+        }
+        else if (SDL_strcmp(argv[i], "--no-wait") == 0)
+        {
+            pacing->nonBlockingAcquire = true;
+        }
+        else if (SDL_strcmp(argv[i], "--fps") == 0)
+        {
+            pacing->frameLimit = SDL_max(SDL_atoi(value), 0);
+            ++i;
+        }
+        else if (SDL_strcmp(argv[i], "--idle") == 0)
+        {
+            pacing->idle = true;
+        }
+    }
+}
+
+void
+frame_pacing_apply(Context *context)
+{
+    // Mailbox and immediate aren't available everywhere, VSYNC always is
+    FramePacing *pacing = &context->pacing;
+    if (!SDL_WindowSupportsGPUPresentMode(context->device,
+                                          context->window,
+                                          pacing->presentMode))
+    {
+        SDL_Log("Present mode %d not supported, using VSYNC", pacing->presentMode);
+        pacing->presentMode = SDL_GPU_PRESENTMODE_VSYNC;
+    }
+    
+    assert(SDL_SetGPUSwapchainParameters(context->device,
+                                         context->window,
+                                         SDL_GPU_SWAPCHAINCOMPOSITION_SDR,
+                                         pacing->presentMode));
+    
+    // Ring buffers are sized for this many frames
+    context->framesInFlight = pacing->framesInFlight;
+    assert(SDL_SetGPUAllowedFramesInFlight(context->device, context->framesInFlight));
+}
+
+bool
+frame_pacing_needs_frame(Context *context)
+{
+    FramePacing *pacing = &context->pacing;
+    if (!pacing->idle || pacing->dirty) return true;
+    
+    // Work that only moves forward as frames are recorded
+    if (!context->startup.ready) return true;
+    if (context->uploads.count) return true;
+    return texture_streamer_busy(&context->streamer);
+}
+
+void
+frame_pacing_wait(FramePacing *pacing)
+{
+    if (!pacing->frameLimit) return;
+    
+    // Sleep until the next frame is due. Deadlines advance by a whole
+    // period so the rate doesn't drift, unless we fell behind.
+    Uint64 period = SDL_NS_PER_SECOND / pacing->frameLimit;
+    Uint64 now = SDL_GetTicksNS();
+    
+    if (now < pacing->nextFrameTime)
+    {
+        SDL_DelayPrecise(pacing->nextFrameTime - now);
+        pacing->nextFrameTime += period;
+    }
+    else
+    {
+        pacing->nextFrameTime = now + period;
+    }
+}
+
+void
+frame_timing_begin(FrameTiming *timing)
+{
+    timing->frameStart = SDL_GetTicksNS();
+    timing->phaseStart = timing->frameStart;
+    SDL_zeroa(timing->current);
+}
+
+void
+frame_timing_mark(FrameTiming *timing,
+                  FramePhase phase)
+{
+    // Ends the phase, the time since the last mark is charged to it
+    Uint64 now = SDL_GetTicksNS();
+    timing->current[phase] += now - timing->phaseStart;
+    timing->phaseStart = now;
+}
+
+void
+frame_timing_end(FrameTiming *timing)
+{
+    // Frames that are never ended, skipped or minimized, aren't recorded
+    timing->current[PHASE_TOTAL] = SDL_GetTicksNS() - timing->frameStart;
+    
+    for (Uint32 phase = 0; phase < PHASE_COUNT; ++phase)
+    {
+        timing->samples[phase][timing->next] = timing->current[phase];
+    }
+    
+    timing->next = (timing->next + 1) % FRAME_TIMING_HISTORY;
+    timing->sampleCount = SDL_min(timing->sampleCount + 1, FRAME_TIMING_HISTORY);
+    timing->frameCount++;
+}
+
+void
+frame_timing_submit(FrameTiming *timing,
+                    SDL_GPUCommandBuffer *cmdbuf)
+{
+    if (!timing->gpuTiming)
+    {
+        SDL_SubmitGPUCommandBuffer(cmdbuf);
+        return;
+    }
+    
+    SDL_GPUFence *fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cmdbuf);
+    assert(fence);
+    assert(timing->fenceCount < MAX_TIMED_FENCES);
+    
+    // Frames the GPU hasn't finished, including this one
+    Uint32 slot = (timing->fenceFirst + timing->fenceCount) % MAX_TIMED_FENCES;
+    timing->fences[slot] = fence;
+    timing->fenceSubmitTimes[slot] = SDL_GetTicksNS();
+    timing->fenceFramesInFlight[slot] = ++timing->fenceCount;
+}
+
+void
+frame_timing_poll_fences(Context *context,
+                         FrameTiming *timing,
+                         Uint32 maxPending)
+{
+    // Frames complete in order, so stop at the first one still running,
+    // unless more than maxPending are. Completion is only noticed when
+    // polled, so latencies are rounded up to the next poll.
+    while (timing->fenceCount)
+    {
+        SDL_GPUFence *fence = timing->fences[timing->fenceFirst];
+        if (timing->fenceCount > maxPending)
+        {
+            SDL_WaitForGPUFences(context->device, true, &fence, 1);
+        }
+        else if (!SDL_QueryGPUFence(context->device, fence))
+        {
+            break;
+        }
+        
+        // The GPU works on one frame at a time, so its span starts at
+        // submit or when the previous frame finished, whichever is later
+        Uint64 now = SDL_GetTicksNS();
+        Uint64 submitTime = timing->fenceSubmitTimes[timing->fenceFirst];
+        trace_emit(&context->tracer, "gpu_frame",
+                   SDL_max(submitTime, timing->gpuLastComplete), now,
+                   true);
+        timing->gpuLastComplete = now;
+        
+        timing->gpuLatency[timing->gpuNext] = now - submitTime;
+        timing->gpuFramesInFlight[timing->gpuNext] =
+            timing->fenceFramesInFlight[timing->fenceFirst];
+        timing->gpuNext = (timing->gpuNext + 1) % FRAME_TIMING_HISTORY;
+        timing->gpuSampleCount = SDL_min(timing->gpuSampleCount + 1, FRAME_TIMING_HISTORY);
+        
+        SDL_ReleaseGPUFence(context->device, fence);
+        timing->fenceFirst = (timing->fenceFirst + 1) % MAX_TIMED_FENCES;
+        timing->fenceCount--;
+    }
+}
+
+void
+frame_timing_init(Context *context,
+                  int argc,
+                  char **argv,
+                  const char *csvPath)
+{
+    // --timings path, --gpu-timing for fences and --trace path
+    context->timing.csvPath = csvPath;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], "--timings") == 0 && i + 1 < argc) context->timing.csvPath = argv[i + 1];
+        if (SDL_strcmp(argv[i], "--gpu-timing") == 0) context->timing.gpuTiming = true;
+        
+        // The GPU spans in the trace come from the timing fences
+        if (SDL_strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            create_tracer(&context->tracer, argv[i + 1]);
+            context->timing.gpuTiming = true;
+        }
+    }
+}
+
+int
+frame_timing_sort_compare(const void *a, const void *b)
+{
+    Uint64 x = *(const Uint64 *)a;
+    Uint64 y = *(const Uint64 *)b;
+    return (x > y) - (x < y);
+}
+
+void
+frame_timing_write_row(SDL_IOStream *file,
+                       const char *name,
+                       Uint64 *samples,
+                       Uint32 count,
+                       double scale)
+{
+    if (!count) return;
+    
+    Uint64 sorted[FRAME_TIMING_HISTORY];
+    Uint64 sum = 0;
+    for (Uint32 i = 0; i < count; ++i)
+    {
+        sorted[i] = samples[i];
+        sum += sorted[i];
+    }
+    SDL_qsort(sorted, count, sizeof(Uint64), frame_timing_sort_compare);
+    
+    // Nearest rank
+    SDL_IOprintf(file, "%s,%u,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                 name,
+                 count,
+                 sum / (double)count * scale,
+                 sorted[(count - 1) * 50 / 100] * scale,
+                 sorted[(count - 1) * 95 / 100] * scale,
+                 sorted[(count - 1) * 99 / 100] * scale,
+                 sorted[count - 1] * scale);
+}
+
+void
+frame_timing_write_csv(FrameTiming *timing)
+{
+    // One row per phase over the frames in the ring, then the GPU rows
+    // when fences are on
+    static const char *phaseNames[PHASE_COUNT] =
+    {
+        "events_ms", "acquire_ms", "update_ms", "upload_ms",
+        "record_ms", "submit_ms", "total_ms"
+    };
+    
+    SDL_IOStream *file = SDL_IOFromFile(timing->csvPath, "w");
+    if (!file)
+    {
+        SDL_Log("Couldn't write %s: %s", timing->csvPath, SDL_GetError());
+        return;
+    }
+    
+    SDL_IOprintf(file, "name,frames,mean,p50,p95,p99,max\n");
+    
+    Uint32 count = timing->sampleCount;
+    for (Uint32 phase = 0; phase < PHASE_COUNT; ++phase)
+    {
+        frame_timing_write_row(file, phaseNames[phase],
+                               timing->samples[phase], count, 1e-6);
+    }
+    
+    // Submit to signalled, and how many frames the GPU had queued
+    frame_timing_write_row(file, "gpu_latency_ms",
+                           timing->gpuLatency, timing->gpuSampleCount, 1e-6);
+    frame_timing_write_row(file, "frames_in_flight",
+                           timing->gpuFramesInFlight, timing->gpuSampleCount, 1.0);
+    
+    SDL_CloseIO(file);
+    SDL_Log("Frame timings for the last %u of %llu frames written to %s",
+            count, (unsigned long long)timing->frameCount, timing->csvPath);
+}
+
+void
+sprite_batch_init(SpriteBatch *batch,
+                  RenderBuffers *buffers,
+                  VertexFormat format,
+                  SDL_GPUGraphicsPipeline *pipeline)
+{
+    *batch = (SpriteBatch){0};
+    batch->buffers = buffers;
+    batch->format = format;
+    batch->quadSize = vertex_format_quad_size(format);
+    batch->defaultPipeline = pipeline;
+    
+    // Limited by both the vertex buffer and the shared quad indices
+    batch->maxQuadCount = SDL_min(buffers->maxSizeVertex / batch->quadSize,
+                                  buffers->maxQuadCount);
+    assert(batch->maxQuadCount > 0);
+}
+
+void
+sprite_batch_flush(Context *context,
+                   SpriteBatch *batch)
+{
+    RenderBuffers *buffers = batch->buffers;
+    
+    Uint32 dataSizeVert = batch->quadCount * batch->quadSize;
+    
+    if (batch->vertices)
+    {
+        // Every job writing into the mapping has to be done first
+        Uint64 zone = trace_begin(&context->tracer);
+        job_system_wait(&context->jobs, &batch->pendingJobs);
+        batch->expansionCount = 0;
+        trace_end(&context->tracer, "sprite_jobs_wait", zone);
+        
+        SDL_UnmapGPUTransferBuffer(context->device, buffers->transfer);
+        batch->vertices = 0;
+    }
+    
+    if (batch->quadCount > 0)
+    {
+        // Copy passes can't run inside a render pass, so every flush uploads
+        // first and then draws everything that was pushed since the last one
+        Uint64 zone = trace_begin(&context->tracer);
+        SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(batch->cmdbuf);
+        
+        // Upload vertex data
+        SDL_UploadToGPUBuffer(copyPass,
+                              &(SDL_GPUTransferBufferLocation)
+                              {
+                                  buffers->transfer,
+                                  batch->transferOffset
+                              },
+                              &(SDL_GPUBufferRegion)
+                              {
+                                  buffers->vertex, 0, dataSizeVert
+                              },
+                              true); // cycle
+        
+        SDL_EndGPUCopyPass(copyPass);
+        trace_end(&context->tracer, "sprite_batch_upload", zone);
+    }
+    
+    // Draw the batch, but skip empty passes once the target has been started
+    if (batch->drawCount > 0 || !batch->targetStarted)
+    {
+        // Only the last pass decides whether the result is kept
+        RenderTarget target = batch->target;
+        if (batch->targetStarted)
+        {
+            target.loadOp = SDL_GPU_LOADOP_LOAD;
+            target.cycle = false;
+        }
+        if (!batch->ending)
+        {
+            target.storeOp = SDL_GPU_STOREOP_STORE;
+        }
+        
+        render_pass(context,
+                    batch->cmdbuf,
+                    0, // pipeline
+                    0, // texture
+                    SAMPLER_POINT,
+                    target,
+                    buffers,
+                    batch->draws,
+                    batch->drawCount,
+                    batch->matrix,
+                    0); // post-process data
+        
+        batch->targetStarted = true;
+        batch->drawCallCount += batch->drawCount;
+        batch->flushCount++;
+    }
+    
+    batch->quadCount = 0;
+    batch->drawCount = 0;
+}
+
+void
+sprite_batch_begin(Context *context,
+                   SpriteBatch *batch,
+                   SDL_GPUCommandBuffer *cmdbuf,
+                   RenderTarget target,
+                   float matrix[])
+{
+    assert(!batch->cmdbuf);
+    
+    batch->cmdbuf = cmdbuf;
+    batch->target = target;
+    SDL_memcpy(batch->matrix, matrix, sizeof(batch->matrix));
+    batch->targetStarted = false;
+    batch->ending = false;
+    
+    batch->pipeline = batch->defaultPipeline;
+    batch->texture = 0;
+    batch->sampler = SAMPLER_POINT;
+    batch->transferOffset = buffers_frame_offset(context, batch->buffers);
+    batch->quadCount = 0;
+    batch->drawCount = 0;
+    
+    batch->quadsPushed = 0;
+    batch->flushCount = 0;
+    batch->drawCallCount = 0;
+}
+
+void
+sprite_batch_set_pipeline(SpriteBatch *batch,
+                          SDL_GPUGraphicsPipeline *pipeline)
+{
+    // The next quad starts a new draw if the pipeline changed
+    batch->pipeline = pipeline;
+}
+
+void
+sprite_batch_set_sampler(SpriteBatch *batch,
+                         SamplerType sampler)
+{
+    // The next quad starts a new draw if the sampler changed
+    batch->sampler = sampler;
+}
+
+void
+sprite_write_quad(VertexFormat format,
+                  Uint8 *vertices,
+                  const Sprite *sprite)
+{
+    float x = sprite->x;
+    float y = sprite->y;
+    float w = sprite->w;
+    float h = sprite->h;
+    SDL_FColor color = sprite->color;
+    
+    // Corners relative to the top left, rotated around the centre
+    float cornerX[4] = { 0, w, w, 0 };
+    float cornerY[4] = { 0, 0, h, h };
+    if (sprite->rotation != 0.0f && format != VERTEX_FORMAT_INSTANCE)
+    {
+        float c = SDL_cosf(sprite->rotation);
+        float s = SDL_sinf(sprite->rotation);
+        for (int corner = 0; corner < 4; ++corner)
+        {
+            float localX = cornerX[corner] - 0.5f * w;
+            float localY = cornerY[corner] - 0.5f * h;
+            cornerX[corner] = 0.5f * w + localX * c - localY * s;
+            cornerY[corner] = 0.5f * h + localX * s + localY * c;
+        }
+    }
+    
+    // Write straight into the mapped memory, front to back
+    if (format == VERTEX_FORMAT_INSTANCE)
+    {
+        SpriteInstance *instance = (SpriteInstance *)vertices;
+        *instance = (SpriteInstance)
+        {
+            x, y,
+            w, h,
+            (Uint16)(SDL_clamp(sprite->u0, 0.0f, 1.0f) * 65535.0f + 0.5f),
+            (Uint16)(SDL_clamp(sprite->v0, 0.0f, 1.0f) * 65535.0f + 0.5f),
+            (Uint16)(SDL_clamp(sprite->u1, 0.0f, 1.0f) * 65535.0f + 0.5f),
+            (Uint16)(SDL_clamp(sprite->v1, 0.0f, 1.0f) * 65535.0f + 0.5f),
+            (Uint8)(SDL_clamp(color.r, 0.0f, 1.0f) * 255.0f + 0.5f),
+            (Uint8)(SDL_clamp(color.g, 0.0f, 1.0f) * 255.0f + 0.5f),
+            (Uint8)(SDL_clamp(color.b, 0.0f, 1.0f) * 255.0f + 0.5f),
+            (Uint8)(SDL_clamp(color.a, 0.0f, 1.0f) * 255.0f + 0.5f),
+            sprite->rotation
+        };
+    }
+    else if (format == VERTEX_FORMAT_PACKED)
+    {
+        Uint16 pu0 = (Uint16)(SDL_clamp(sprite->u0, 0.0f, 1.0f) * 65535.0f + 0.5f);
+        Uint16 pv0 = (Uint16)(SDL_clamp(sprite->v0, 0.0f, 1.0f) * 65535.0f + 0.5f);
+        Uint16 pu1 = (Uint16)(SDL_clamp(sprite->u1, 0.0f, 1.0f) * 65535.0f + 0.5f);
+        Uint16 pv1 = (Uint16)(SDL_clamp(sprite->v1, 0.0f, 1.0f) * 65535.0f + 0.5f);
+        
+        Uint8 r = (Uint8)(SDL_clamp(color.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+        Uint8 g = (Uint8)(SDL_clamp(color.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+        Uint8 b = (Uint8)(SDL_clamp(color.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+        Uint8 a = (Uint8)(SDL_clamp(color.a, 0.0f, 1.0f) * 255.0f + 0.5f);
+        
+        PackedVertex *v = (PackedVertex *)vertices;
+        v[0] = (PackedVertex){ x + cornerX[0], y + cornerY[0],    pu0, pv0,    r, g, b, a };
+        v[1] = (PackedVertex){ x + cornerX[1], y + cornerY[1],    pu1, pv0,    r, g, b, a };
+        v[2] = (PackedVertex){ x + cornerX[2], y + cornerY[2],    pu1, pv1,    r, g, b, a };
+        v[3] = (PackedVertex){ x + cornerX[3], y + cornerY[3],    pu0, pv1,    r, g, b, a };
+    }
+    else
+    {
+        float u0 = sprite->u0, v0 = sprite->v0;
+        float u1 = sprite->u1, v1 = sprite->v1;
+        
+        Vertex *v = (Vertex *)vertices;
+        v[0] = (Vertex){ x + cornerX[0], y + cornerY[0],    u0, v0,    color.r, color.g, color.b, color.a };
+        v[1] = (Vertex){ x + cornerX[1], y + cornerY[1],    u1, v0,    color.r, color.g, color.b, color.a };
+        v[2] = (Vertex){ x + cornerX[2], y + cornerY[2],    u1, v1,    color.r, color.g, color.b, color.a };
+        v[3] = (Vertex){ x + cornerX[3], y + cornerY[3],    u0, v1,    color.r, color.g, color.b, color.a };
+    }
+}
+
+void
+sprite_expand_job(void *data,
+                  Uint32 first,
+                  Uint32 count)
+{
+    SpriteExpansion *expansion = data;
+    Uint32 quadSize = vertex_format_quad_size(expansion->format);
+    
+    for (Uint32 i = first; i < first + count; ++i)
+    {
+        sprite_write_quad(expansion->format,
+                          expansion->vertices + i * quadSize,
+                          expansion->sprites + i);
+    }
+}
+
+BatchDraw *
+sprite_batch_next_draw(Context *context,
+                       SpriteBatch *batch,
+                       SDL_GPUTexture *texture)
+{
+    assert(batch->cmdbuf);
+    
+    // Flush when the buffers or the draw list are full
+    if (batch->quadCount == batch->maxQuadCount)
+    {
+        sprite_batch_flush(context, batch);
+    }
+    
+    // Start a new draw when the texture, sampler or pipeline changes
+    BatchDraw *draw = batch->drawCount ? batch->draws + batch->drawCount - 1 : 0;
+    if (!draw ||
+        draw->texture != texture ||
+        draw->sampler != batch->sampler ||
+        draw->pipeline != batch->pipeline)
+    {
+        if (batch->drawCount == MAX_BATCH_DRAWS)
+        {
+            sprite_batch_flush(context, batch);
+        }
+        
+        draw = batch->draws + batch->drawCount++;
+        draw->pipeline = batch->pipeline;
+        draw->texture = texture;
+        draw->sampler = batch->sampler;
+        draw->firstIndex = batch->quadCount * 6;
+        draw->indexCount = 0;
+        draw->instanceStride =
+            (batch->format == VERTEX_FORMAT_INSTANCE) ? batch->quadSize : 0;
+        draw->firstInstance = batch->quadCount;
+        draw->instanceCount = 0;
+    }
+    
+    // Map lazily, writing into this frame's slice of the ring. If an
+    // earlier flush this frame still owns the slice we have to cycle.
+    if (!batch->vertices)
+    {
+        Uint8 *destData = SDL_MapGPUTransferBuffer(context->device,
+                                                   batch->buffers->transfer,
+                                                   batch->flushCount > 0);
+        batch->vertices = destData + batch->transferOffset;
+    }
+    
+    return draw;
+}
+
+void
+sprite_batch_push_sprite(Context *context,
+                         SpriteBatch *batch,
+                         SDL_GPUTexture *texture,
+                         float x, float y, float w, float h,
+                         float u0, float v0, float u1, float v1,
+                         SDL_FColor color,
+                         float rotation)
+{
+    // The packed and instance formats store UVs as UNORM16, so they are
+    // clamped to [0, 1]. Wrapped or negative UVs need VERTEX_FORMAT_FLOAT.
+    BatchDraw *draw = sprite_batch_next_draw(context, batch, texture);
+    
+    sprite_write_quad(batch->format,
+                      batch->vertices + batch->quadCount * batch->quadSize,
+                      &(Sprite){ x, y, w, h, u0, v0, u1, v1, color, rotation });
+    
+    // Indices come from the static quad index buffer
+    draw->indexCount += 6;
+    draw->instanceCount++;
+    batch->quadCount++;
+    batch->quadsPushed++;
+}
+
+void
+sprite_batch_push_sprites(Context *context,
+                          SpriteBatch *batch,
+                          SDL_GPUTexture *texture,
+                          const Sprite *sprites,
+                          Uint32 spriteCount)
+{
+    // Large runs are expanded on the job system while the caller carries
+    // on, so the sprites must stay valid until the batch is flushed
+    while (spriteCount > 0)
+    {
+        BatchDraw *draw = sprite_batch_next_draw(context, batch, texture);
+        Uint32 count = SDL_min(spriteCount, batch->maxQuadCount - batch->quadCount);
+        Uint8 *vertices = batch->vertices + batch->quadCount * batch->quadSize;
+        
+        if (count < SPRITE_JOB_GRAIN)
+        {
+            for (Uint32 i = 0; i < count; ++i)
+            {
+                sprite_write_quad(batch->format, vertices + i * batch->quadSize, sprites + i);
+            }
+        }
+        else
+        {
+            // Out of slots, wait for the runs in flight so theirs can be reused
+            if (batch->expansionCount == MAX_BATCH_EXPANSIONS)
+            {
+                job_system_wait(&context->jobs, &batch->pendingJobs);
+                batch->expansionCount = 0;
+            }
+            
+            SpriteExpansion *expansion = batch->expansions + batch->expansionCount++;
+            *expansion = (SpriteExpansion){ batch->format, vertices, sprites };
+            job_system_run(&context->jobs, sprite_expand_job, expansion,
+                           count, SPRITE_JOB_GRAIN, &batch->pendingJobs);
+        }
+        
+        draw->indexCount += count * 6;
+        draw->instanceCount += count;
+        batch->quadCount += count;
+        batch->quadsPushed += count;
+        
+        sprites += count;
+        spriteCount -= count;
+    }
+}
+
+void
+sprite_batch_push_quad(Context *context,
+                       SpriteBatch *batch,
+                       SDL_GPUTexture *texture,
+                       float x, float y, float w, float h,
+                       float u0, float v0, float u1, float v1,
+                       SDL_FColor color)
+{
+    sprite_batch_push_sprite(context, batch, texture,
+                             x, y, w, h,
+                             u0, v0, u1, v1,
+                             color,
+                             0.0f); // rotation
+}
+
+void
+sprite_batch_end(Context *context,
+                 SpriteBatch *batch)
+{
+    assert(batch->cmdbuf);
+    
+    // Always flush so the target is cleared even if nothing was pushed
+    batch->ending = true;
+    sprite_batch_flush(context, batch);
+    
+    batch->cmdbuf = 0;
+    batch->target = (RenderTarget){0};
+}
+
+void
+readback_path(char *path,
+              size_t pathSize,
+              const char *directory,
+              const char *name,
+              const char *extension)
+{
+    path[0] = 0;
+    SDL_strlcat(path, directory, pathSize);
+    SDL_strlcat(path, "/", pathSize);
+    SDL_strlcat(path, name, pathSize);
+    SDL_strlcat(path, extension, pathSize);
+}
+
+Uint8 *
+ppm_parse(Uint8 *data,
+          size_t size,
+          Uint32 *width,
+          Uint32 *height)
+{
+    // Binary PPM with 8-bit channels, returns the first pixel
+    Uint32 values[3] = {0};
+    size_t at = 2;
+    if (size < 2 || data[0] != 'P' || data[1] != '6') return 0;
+    
+    for (Uint32 i = 0; i < 3; ++i)
+    {
+        while (at < size && SDL_isspace(data[at])) ++at;
+        if (at == size || !SDL_isdigit(data[at])) return 0;
+        while (at < size && SDL_isdigit(data[at])) values[i] = values[i] * 10 + (data[at++] - '0');
+    }
+    
+    // Exactly one whitespace character before the pixels
+    if (values[2] != 255 || ++at > size) return 0;
+    if (size - at < (size_t)values[0] * values[1] * 3) return 0;
+    
+    *width = values[0];
+    *height = values[1];
+    return data + at;
+}
+
+Uint8 *
+qoi_encode(const Uint8 *rgb,
+           Uint32 width,
+           Uint32 height,
+           size_t *size)
+{
+    // QOI with 3 channels. Alpha is always 255, so there are never any
+    // RGBA chunks and a pixel takes at most 4 bytes.
+    Uint32 pixelCount = width * height;
+    Uint8 *data = SDL_malloc(14 + (size_t)pixelCount * 4 + 8);
+    assert(data);
+    
+    SDL_memcpy(data, "qoif", 4);
+    for (Uint32 i = 0; i < 4; ++i)
+    {
+        data[4 + i] = (Uint8)(width >> (24 - i * 8));
+        data[8 + i] = (Uint8)(height >> (24 - i * 8));
+    }
+    data[12] = 3; // channels
+    data[13] = 0; // sRGB
+    size_t at = 14;
+    
+    // Recently seen pixels by hash. They start out transparent, so none
+    // of them match before they're written.
+    Uint8 seen[64][4] = {0};
+    Uint8 previous[3] = {0};
+    Uint32 run = 0;
+    
+    for (Uint32 p = 0; p < pixelCount; ++p)
+    {
+        Uint8 r = rgb[p * 3 + 0];
+        Uint8 g = rgb[p * 3 + 1];
+        Uint8 b = rgb[p * 3 + 2];
+        
+        if (r == previous[0] && g == previous[1] && b == previous[2])
+        {
+            if (++run == 62 || p == pixelCount - 1)
+            {
+                data[at++] = (Uint8)(0xC0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        
+        if (run)
+        {
+            data[at++] = (Uint8)(0xC0 | (run - 1));
+            run = 0;
+        }
+        
+        Uint32 hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+        if (seen[hash][0] == r && seen[hash][1] == g && seen[hash][2] == b && seen[hash][3] == 255)
+        {
+            data[at++] = (Uint8)hash;
+        }
+        else
+        {
+            seen[hash][0] = r;
+            seen[hash][1] = g;
+            seen[hash][2] = b;
+            seen[hash][3] = 255;
+            
+            // Differences wrap around, like the channels do
+            int dr = (Sint8)(Uint8)(r - previous[0]);
+            int dg = (Sint8)(Uint8)(g - previous[1]);
+            int db = (Sint8)(Uint8)(b - previous[2]);
+            int drg = dr - dg;
+            int dbg = db - dg;
+            
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+            {
+                data[at++] = (Uint8)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            }
+            else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+            {
+                data[at++] = (Uint8)(0x80 | (dg + 32));
+                data[at++] = (Uint8)((drg + 8) << 4 | (dbg + 8));
+            }
+            else
+            {
+                data[at++] = 0xFE;
+                data[at++] = r;
+                data[at++] = g;
+                data[at++] = b;
+            }
+        }
+        
+        previous[0] = r;
+        previous[1] = g;
+        previous[2] = b;
+    }
+    
+    // End marker
+    SDL_memset(data + at, 0, 7);
+    data[at + 7] = 1;
+    *size = at + 8;
+    
+    return data;
+}
+
+void
+readback_process(Readback *readback,
+                 ReadbackJob *job)
+{
+    // Tightly packed RGB, the same layout as the PPM pixels
+    Uint32 pixelCount = job->width * job->height;
+    Uint8 *rgb = SDL_malloc(pixelCount * 3);
+    assert(rgb);
+    for (Uint32 p = 0; p < pixelCount; ++p)
+    {
+        Uint8 *src = job->pixels + p * 4;
+        rgb[p * 3 + 0] = job->bgra ? src[2] : src[0];
+        rgb[p * 3 + 1] = src[1];
+        rgb[p * 3 + 2] = job->bgra ? src[0] : src[2];
+    }
+    
+    char path[512];
+    if (readback->goldenDirectory)
+    {
+        readback_path(path, sizeof(path), readback->goldenDirectory, job->name, ".ppm");
+        
+        size_t size = 0;
+        Uint8 *golden = SDL_LoadFile(path, &size);
+        Uint32 width = 0;
+        Uint32 height = 0;
+        Uint8 *goldenPixels = golden ? ppm_parse(golden, size, &width, &height) : 0;
+        
+        // A pixel fails when any channel is further off than the tolerance
+        Uint32 failedPixels = 0;
+        Uint32 maxDifference = 0;
+        if (goldenPixels && width == job->width && height == job->height)
+        {
+            for (Uint32 p = 0; p < pixelCount; ++p)
+            {
+                Uint32 pixelDifference = 0;
+                for (Uint32 c = 0; c < 3; ++c)
+                {
+                    Uint32 difference = SDL_abs((int)rgb[p * 3 + c] - (int)goldenPixels[p * 3 + c]);
+                    pixelDifference = SDL_max(pixelDifference, difference);
+                }
+                maxDifference = SDL_max(maxDifference, pixelDifference);
+                if (pixelDifference > readback->tolerance) failedPixels++;
+            }
+        }
+        
+        if (!goldenPixels)
+        {
+            SDL_Log("Golden %s: missing or not a PPM", path);
+            SDL_AddAtomicInt(&readback->mismatchCount, 1);
+        }
+        else if (width != job->width || height != job->height)
+        {
+            SDL_Log("Golden %s: %ux%u, captured %ux%u",
+                    path, width, height, job->width, job->height);
+            SDL_AddAtomicInt(&readback->mismatchCount, 1);
+        }
+        else if (failedPixels)
+        {
+            SDL_Log("Golden %s: %u pixels off by more than %u, up to %u",
+                    path, failedPixels, readback->tolerance, maxDifference);
+            SDL_AddAtomicInt(&readback->mismatchCount, 1);
+        }
+        else
+        {
+            SDL_Log("Golden %s: match, largest difference %u", path, maxDifference);
+        }
+        
+        SDL_free(golden);
+    }
+    else
+    {
+        // Raw files have no header, so the size goes into the name
+        char extension[32] = ".ppm";
+        if (readback->format == CAPTURE_FORMAT_RAW)
+        {
+            SDL_snprintf(extension, sizeof(extension), "_%ux%u.rgb", job->width, job->height);
+        }
+        else if (readback->format == CAPTURE_FORMAT_QOI)
+        {
+            SDL_strlcpy(extension, ".qoi", sizeof(extension));
+        }
+        readback_path(path, sizeof(path), readback->directory, job->name, extension);
+        
+        SDL_IOStream *file = SDL_IOFromFile(path, "wb");
+        if (file)
+        {
+            if (readback->format == CAPTURE_FORMAT_QOI)
+            {
+                size_t size = 0;
+                Uint8 *qoi = qoi_encode(rgb, job->width, job->height, &size);
+                SDL_WriteIO(file, qoi, size);
+                SDL_free(qoi);
+            }
+            else
+            {
+                if (readback->format == CAPTURE_FORMAT_PPM)
+                {
+                    SDL_IOprintf(file, "P6\n%u %u\n255\n", job->width, job->height);
+                }
+                SDL_WriteIO(file, rgb, pixelCount * 3);
+            }
+            SDL_CloseIO(file);
+        }
+        else
+        {
+            SDL_Log("Couldn't write %s: %s", path, SDL_GetError());
+        }
+    }
+    
+    SDL_free(rgb);
+}
+
+int
+readback_worker(void *data)
+{
+    Readback *readback = data;
+    
+    for (;;)
+    {
+        // Jobs still queued when asked to quit are finished first
+        SDL_LockMutex(readback->mutex);
+        while (!readback->quit && readback->jobCount == 0)
+        {
+            SDL_WaitCondition(readback->jobAvailable, readback->mutex);
+        }
+        if (readback->jobCount == 0)
+        {
+            SDL_UnlockMutex(readback->mutex);
+            break;
+        }
+        
+        ReadbackJob job = readback->jobs[readback->jobFirst];
+        readback->jobFirst = (readback->jobFirst + 1) % MAX_READBACK_JOBS;
+        readback->jobCount--;
+        SDL_UnlockMutex(readback->mutex);
+        
+        readback_process(readback, &job);
+        SDL_free(job.pixels);
+    }
+    
+    return 0;
+}
+
+void
+create_readback(Readback *readback,
+                int argc,
+                char **argv)
+{
+    // --capture-dir dir, --capture-format ppm|raw|qoi, --golden dir to
+    // compare instead of write, and --tolerance N for the largest channel
+    // difference that still matches
+    *readback = (Readback){0};
+    readback->directory = "captures";
+    readback->tolerance = 2;
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        char *value = (i + 1 < argc) ? argv[i + 1] : "";
+        
+        if (SDL_strcmp(argv[i], "--capture-dir") == 0) readback->directory = value;
+        else if (SDL_strcmp(argv[i], "--capture-format") == 0)
+        {
+            if (SDL_strcmp(value, "raw") == 0) readback->format = CAPTURE_FORMAT_RAW;
+            else if (SDL_strcmp(value, "qoi") == 0) readback->format = CAPTURE_FORMAT_QOI;
+            else readback->format = CAPTURE_FORMAT_PPM;
+        }
+        else if (SDL_strcmp(argv[i], "--golden") == 0) readback->goldenDirectory = value;
+        else if (SDL_strcmp(argv[i], "--tolerance") == 0) readback->tolerance = SDL_max(SDL_atoi(value), 0);
+        else continue;
+        ++i;
+    }
+    
+    if (!readback->goldenDirectory)
+    {
+        SDL_CreateDirectory(readback->directory);
+    }
+    
+    readback->mutex = SDL_CreateMutex();
+    readback->jobAvailable = SDL_CreateCondition();
+    readback->worker = SDL_CreateThread(readback_worker, "readback", readback);
+    assert(readback->mutex && readback->jobAvailable && readback->worker);
+}
+
+bool
+readback_capture(Context *context,
+                 Readback *readback,
+                 SDL_GPUTexture *texture,
+                 Uint32 width, Uint32 height,
+                 SDL_GPUTextureFormat format,
+                 const char *name)
+{
+    // Only 4 byte RGBA or BGRA targets are captured
+    assert(format == SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM ||
+           format == SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM_SRGB ||
+           format == SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM ||
+           format == SDL_GPU_TEXTUREFORMAT_R8G8B8A8_UNORM_SRGB);
+    
+    ReadbackSlot *slot = 0;
+    for (Uint32 i = 0; i < READBACK_SLOTS && !slot; ++i)
+    {
+        if (readback->slots[i].state == READBACK_FREE) slot = readback->slots + i;
+    }
+    
+    // Never wait for the GPU here, a busy ring means the capture is lost
+    if (!slot)
+    {
+        readback->droppedCount++;
+        return false;
+    }
+    
+    Uint32 size = width * height * 4;
+    if (slot->transferSize < size)
+    {
+        SDL_ReleaseGPUTransferBuffer(context->device, slot->transfer);
+        slot->transfer =
+            SDL_CreateGPUTransferBuffer(context->device,
+                                        &(SDL_GPUTransferBufferCreateInfo)
+                                        {
+                                            SDL_GPU_TRANSFERBUFFERUSAGE_DOWNLOAD,
+                                            size
+                                        });
+        assert(slot->transfer);
+        slot->transferSize = size;
+    }
+    
+    // Submitted by readback_submit after the frame, so it runs after the
+    // frame's passes on the GPU
+    slot->cmdbuf = SDL_AcquireGPUCommandBuffer(context->device);
+    assert(slot->cmdbuf);
+    
+    SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(slot->cmdbuf);
+    SDL_DownloadFromGPUTexture(copyPass,
+                               &(SDL_GPUTextureRegion)
+                               {
+                                   .texture = texture,
+                                   .w = width,
+                                   .h = height,
+                                   .d = 1
+                               },
+                               &(SDL_GPUTextureTransferInfo)
+                               {
+                                   .transfer_buffer = slot->transfer
+                               });
+    SDL_EndGPUCopyPass(copyPass);
+    
+    slot->state = READBACK_RECORDED;
+    slot->width = width;
+    slot->height = height;
+    slot->bgra = (format == SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM ||
+                  format == SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM_SRGB);
+    SDL_strlcpy(slot->name, name, sizeof(slot->name));
+    readback->captureCount++;
+    return true;
+}
+
+void
+readback_submit(Readback *readback)
+{
+    // Called right after the frame's command buffer is submitted
+    for (Uint32 i = 0; i < READBACK_SLOTS; ++i)
+    {
+        ReadbackSlot *slot = readback->slots + i;
+        if (slot->state == READBACK_RECORDED)
+        {
+            slot->fence = SDL_SubmitGPUCommandBufferAndAcquireFence(slot->cmdbuf);
+            assert(slot->fence);
+            slot->cmdbuf = 0;
+            slot->state = READBACK_IN_FLIGHT;
+        }
+    }
+}
+
+void
+readback_update(Context *context,
+                Readback *readback,
+                bool wait)
+{
+    // Hands finished downloads to the worker. Slots stay busy while its
+    // queue is full, which in turn drops new captures.
+    for (Uint32 i = 0; i < READBACK_SLOTS; ++i)
+    {
+        ReadbackSlot *slot = readback->slots + i;
+        if (slot->state != READBACK_IN_FLIGHT) continue;
+        
+        if (wait)
+        {
+            SDL_WaitForGPUFences(context->device, true, &slot->fence, 1);
+        }
+        else if (!SDL_QueryGPUFence(context->device, slot->fence))
+        {
+            continue;
+        }
+        
+        SDL_LockMutex(readback->mutex);
+        bool queueFull = (readback->jobCount == MAX_READBACK_JOBS);
+        SDL_UnlockMutex(readback->mutex);
+        if (queueFull && !wait) continue;
+        
+        Uint32 size = slot->width * slot->height * 4;
+        ReadbackJob job =
+        {
+            .pixels = SDL_malloc(size),
+            .width = slot->width,
+            .height = slot->height,
+            .bgra = slot->bgra
+        };
+        assert(job.pixels);
+        SDL_strlcpy(job.name, slot->name, sizeof(job.name));
+        
+        void *data = SDL_MapGPUTransferBuffer(context->device, slot->transfer, false);
+        SDL_memcpy(job.pixels, data, size);
+        SDL_UnmapGPUTransferBuffer(context->device, slot->transfer);
+        
+        SDL_ReleaseGPUFence(context->device, slot->fence);
+        slot->fence = 0;
+        slot->state = READBACK_FREE;
+        
+        // When waiting, the worker is the only one who can make room
+        SDL_LockMutex(readback->mutex);
+        while (readback->jobCount == MAX_READBACK_JOBS)
+        {
+            SDL_UnlockMutex(readback->mutex);
+            SDL_Delay(1);
+            SDL_LockMutex(readback->mutex);
+        }
+        readback->jobs[(readback->jobFirst + readback->jobCount) % MAX_READBACK_JOBS] = job;
+        readback->jobCount++;
+        SDL_SignalCondition(readback->jobAvailable);
+        SDL_UnlockMutex(readback->mutex);
+    }
+}
+
+bool
+readback_pending(Readback *readback)
+{
+    // Downloads only finish when readback_update polls them
+    for (Uint32 i = 0; i < READBACK_SLOTS; ++i)
+    {
+        if (readback->slots[i].state == READBACK_IN_FLIGHT) return true;
+    }
+    return false;
+}
+
+void
+release_readback(Context *context,
+                 Readback *readback)
+{
+    // Everything captured so far still reaches the disk
+    readback_update(context, readback, true);
+    
+    SDL_LockMutex(readback->mutex);
+    readback->quit = true;
+    SDL_SignalCondition(readback->jobAvailable);
+    SDL_UnlockMutex(readback->mutex);
+    SDL_WaitThread(readback->worker, 0);
+    
+    SDL_DestroyCondition(readback->jobAvailable);
+    SDL_DestroyMutex(readback->mutex);
+    
+    for (Uint32 i = 0; i < READBACK_SLOTS; ++i)
+    {
+        if (readback->slots[i].cmdbuf)
+        {
+            SDL_CancelGPUCommandBuffer(readback->slots[i].cmdbuf);
+        }
+        SDL_ReleaseGPUTransferBuffer(context->device, readback->slots[i].transfer);
+    }
+    
+    if (readback->captureCount)
+    {
+        SDL_Log("Readback: %llu captures, %u dropped, %d golden mismatches",
+                (unsigned long long)readback->captureCount,
+                readback->droppedCount,
+                SDL_GetAtomicInt(&readback->mismatchCount));
+    }
+}
+
+BenchmarkConfig
+benchmark_config(int argc,
+                 char **argv)
+{
+    // --benchmark, --quads N, --textures N, --frames N, --no-post,
+    // --capture, and --packed or --instanced for the vertex layout
+    BenchmarkConfig config =
+    {
+        .quadCount = 10000,
+        .textureCount = 1,
+        .postProcess = true,
+        .frameCount = 500,
+        .vertexFormat = VERTEX_FORMAT_FLOAT
+    };
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        char *value = (i + 1 < argc) ? argv[i + 1] : "";
+        
+        if (SDL_strcmp(argv[i], "--benchmark") == 0) config.enabled = true;
+        else if (SDL_strcmp(argv[i], "--no-post") == 0) config.postProcess = false;
+        else if (SDL_strcmp(argv[i], "--capture") == 0) config.capture = true;
+        else if (SDL_strcmp(argv[i], "--packed") == 0) config.vertexFormat = VERTEX_FORMAT_PACKED;
+        else if (SDL_strcmp(argv[i], "--instanced") == 0) config.vertexFormat = VERTEX_FORMAT_INSTANCE;
+        else if (SDL_strcmp(argv[i], "--quads") == 0)
+        {
+            config.quadCount = SDL_max(SDL_atoi(value), 1);
+            ++i;
+        }
+        else if (SDL_strcmp(argv[i], "--textures") == 0)
+        {
+            config.textureCount = SDL_clamp(SDL_atoi(value), 1, MAX_BENCHMARK_TEXTURES);
+            ++i;
+        }
+        else if (SDL_strcmp(argv[i], "--frames") == 0)
+        {
+            config.frameCount = SDL_max(SDL_atoi(value), 1);
+            ++i;
+        }
+    }
+    
+    return config;
+}
+
+int
+run_benchmark(BenchmarkConfig config,
+              int argc,
+              char **argv)
+{
+    // No window or swapchain, the sprite and post-process passes render
+    // into an offscreen texture. Any Vulkan driver will do, including a
+    // software one like lavapipe on a machine without a GPU.
+    Context context = {0};
+    VertexFormat vertexFormat = config.vertexFormat;
+    
+    // Nothing is shown, so don't ask for a display. SDL_VIDEO_DRIVER in
+    // the environment still wins.
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+    assert(SDL_Init(SDL_INIT_VIDEO));
+    
+    context.basePath = (char *)SDL_GetBasePath();
+    assert(context.basePath);
+    
+    context.device = SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV,
+                                         false, 0);
+    assert(context.device);
+    
+    context.winWidth = BENCHMARK_WIDTH;
+    context.winHeight = BENCHMARK_HEIGHT;
+    
+    // Without a swapchain to block on, fences keep the CPU at most this
+    // many frames ahead
+    frame_pacing_init(&context.pacing, argc, argv);
+    context.framesInFlight = context.pacing.framesInFlight;
+    frame_timing_init(&context, argc, argv, "benchmark_timings.csv");
+    context.timing.gpuTiming = true;
+    create_readback(&context.readback, argc, argv);
+    create_job_system(&context.jobs, argc, argv);
+    
+    create_pipeline_cache(&context);
+    startup_begin(&context, "shaders/shaders.pak");
+    startup_add_graphics(&context, &context.pipelineDynamic,
+                         pipeline_sprite_desc(vertexFormat, BLEND_NONE));
+    if (config.postProcess)
+    {
+        startup_add_graphics(&context, &context.pipelinePostProcess,
+                             pipeline_postprocess_desc(&context));
+    }
+    startup_update(&context, true);
+    
+    create_samplers(&context);
+    
+    Uint32 maxQuadCount = SDL_min(config.quadCount, BENCHMARK_BATCH_QUADS);
+    context.buffersDynamic =
+        create_buffers(&context,
+                       vertex_format_quad_size(vertexFormat) * maxQuadCount,
+                       maxQuadCount,
+                       0); // frame count, defaults to frames in flight
+    sprite_batch_init(&context.batch, &context.buffersDynamic,
+                      vertexFormat, context.pipelineDynamic);
+    
+    // One solid colour per texture, each uploaded in its own command
+    // buffer since they share the transfer buffer
+    SDL_GPUTexture *textures[MAX_BENCHMARK_TEXTURES] = {0};
+    Uint32 texData[BENCHMARK_TEXTURE_SIZE * BENCHMARK_TEXTURE_SIZE];
+    create_texture(&context, BENCHMARK_TEXTURE_SIZE, BENCHMARK_TEXTURE_SIZE, 1);
+    
+    for (Uint32 textureIndex = 0; textureIndex < config.textureCount; ++textureIndex)
+    {
+        textures[textureIndex] = (textureIndex == 0) ?
+            context.texture :
+            create_texture_mipmapped(&context,
+                                     BENCHMARK_TEXTURE_SIZE, BENCHMARK_TEXTURE_SIZE,
+                                     1);
+        assert(textures[textureIndex]);
+        
+        Uint32 color = 0xFF000000 | (0x00FFFFFF & (textureIndex * 0x9E3779B9u));
+        for (Uint32 p = 0; p < SDL_arraysize(texData); ++p) texData[p] = color;
+        
+        update_texture(&context, textures[textureIndex],
+                       context.transferBufferTexture,
+                       BENCHMARK_TEXTURE_SIZE, BENCHMARK_TEXTURE_SIZE, 1,
+                       texData);
+        
+        SDL_GPUCommandBuffer *cmdbuf = SDL_AcquireGPUCommandBuffer(context.device);
+        assert(cmdbuf);
+        upload_queue_flush(&context, cmdbuf);
+        SDL_SubmitGPUCommandBuffer(cmdbuf);
+    }
+    
+    // Stands in for the swapchain image
+    SDL_GPUTexture *output =
+        SDL_CreateGPUTexture(context.device,
+                             &(SDL_GPUTextureCreateInfo)
+                             {
+                                 SDL_GPU_TEXTURETYPE_2D,
+                                 SCENE_TARGET_FORMAT,
+                                 SDL_GPU_TEXTUREUSAGE_COLOR_TARGET |
+                                     SDL_GPU_TEXTUREUSAGE_SAMPLER,
+                                 BENCHMARK_WIDTH,
+                                 BENCHMARK_HEIGHT,
+                                 1, // layer count
+                                 1, // mip levels
+                                 SDL_GPU_SAMPLECOUNT_1
+                             });
+    assert(output);
+    
+    float matrix[] =
+    {
+        2.0f / (float)BENCHMARK_WIDTH, 0, 0, -1,
+        0, -2.0f / (float)BENCHMARK_HEIGHT, 0, 1,
+        0, 0, 1, 0,
+        0, 0, 0, 1
+    };
     
-    // Begin a render pass
-    SDL_GPURenderPass* renderPass =
-        SDL_BeginGPURenderPass(cmdbuf, &colorTargetInfo, 1, NULL);
+    // Small quads on a grid, textures in contiguous runs so there is one
+    // draw per texture. The batch expands them on the job system.
+    Sprite *sprites = SDL_malloc(config.quadCount * sizeof(Sprite));
+    assert(sprites);
     
-    if (matrix)
+    SDL_FColor white = { 1.0f, 1.0f, 1.0f, 1.0f };
+    Uint32 columns = BENCHMARK_WIDTH / 8;
+    for (Uint32 quad = 0; quad < config.quadCount; ++quad)
     {
-        SDL_PushGPUVertexUniformData(cmdbuf,
-                                     0,
-                                     matrix,
-                                     sizeof(float) * 16);
+        float x = (float)((quad % columns) * 8);
+        float y = (float)((quad / columns * 8) % BENCHMARK_HEIGHT);
+        sprites[quad] = (Sprite){ x, y, 8.0f, 8.0f, 0, 0, 1, 1, white, 0.0f };
     }
     
-    if (postProcessData)
+    SDL_Log("Benchmark on %s: %u quads, %u textures, post-process %s, %u frames, %u job workers",
+            SDL_GetGPUDeviceDriver(context.device),
+            config.quadCount, config.textureCount,
+            config.postProcess ? "on" : "off",
+            config.frameCount, context.jobs.workerCount);
+    
+    Uint64 startTime = 0;
+    Uint32 totalFrames = BENCHMARK_WARMUP_FRAMES + config.frameCount;
+    for (Uint32 frame = 0; frame < totalFrames; ++frame)
     {
-        SDL_PushGPUFragmentUniformData(cmdbuf,
-                                       0,
-                                       postProcessData,
-                                       sizeof(float) * 4);
+        if (frame == BENCHMARK_WARMUP_FRAMES)
+        {
+            // Let the warm-up frames finish so they aren't counted
+            frame_timing_poll_fences(&context, &context.timing, 0);
+            startTime = SDL_GetTicksNS();
+        }
+        
+        frame_timing_begin(&context.timing);
+        frame_timing_poll_fences(&context, &context.timing, context.framesInFlight - 1);
+        readback_update(&context, &context.readback, false);
+        bool captureFrame = config.capture && frame == totalFrames - 1;
+        frame_timing_mark(&context.timing, PHASE_ACQUIRE);
+        
+        SDL_GPUCommandBuffer *cmdbuf = SDL_AcquireGPUCommandBuffer(context.device);
+        assert(cmdbuf);
+        context.time = frame / 60.0f;
+        frame_timing_mark(&context.timing, PHASE_UPDATE);
+        
+        upload_queue_flush(&context, cmdbuf);
+        frame_timing_mark(&context.timing, PHASE_UPLOAD);
+        
+        // Same passes as the windowed loop, minus the ones for the demo
+        SDL_FColor clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+        RenderGraph *graph = &context.graph;
+        render_graph_begin(graph);
+        
+        Uint32 target = render_graph_import(graph, "output", output, true);
+        Uint32 scene = target;
+        Uint32 postProcessPass = RENDER_GRAPH_NONE;
+        if (config.postProcess)
+        {
+            scene = render_graph_transient(graph, "scene",
+                                           BENCHMARK_WIDTH, BENCHMARK_HEIGHT,
+                                           SCENE_TARGET_FORMAT,
+                                           SDL_GPU_TEXTUREUSAGE_SAMPLER |
+                                               SDL_GPU_TEXTUREUSAGE_COLOR_TARGET);
+        }
+        
+        Uint32 spritePass = render_graph_add_pass(graph, "sprites", scene,
+                                                  RENDER_GRAPH_CLEAR, clearColor);
+        if (config.postProcess)
+        {
+            postProcessPass = render_graph_add_pass(graph, "postprocess", target,
+                                                    RENDER_GRAPH_OVERWRITE, clearColor);
+            render_graph_read(graph, postProcessPass, scene);
+        }
+        
+        render_graph_compile(graph);
+        
+        if (render_graph_pass_begin(&context, graph, spritePass))
+        {
+            sprite_batch_begin(&context, &context.batch, cmdbuf,
+                               render_graph_scaled_target(graph, spritePass,
+                                                          BENCHMARK_WIDTH,
+                                                          BENCHMARK_HEIGHT),
+                               matrix);
+            
+            // Quad q uses texture q * textureCount / quadCount
+            for (Uint32 textureIndex = 0; textureIndex < config.textureCount; ++textureIndex)
+            {
+                Uint32 first = (Uint32)(((Uint64)textureIndex * config.quadCount +
+                                         config.textureCount - 1) / config.textureCount);
+                Uint32 end = (Uint32)(((Uint64)(textureIndex + 1) * config.quadCount +
+                                       config.textureCount - 1) / config.textureCount);
+                
+                sprite_batch_push_sprites(&context, &context.batch,
+                                          textures[textureIndex],
+                                          sprites + first, end - first);
+            }
+            
+            sprite_batch_end(&context, &context.batch);
+            render_graph_pass_end(&context, graph, spritePass);
+        }
+        
+        if (render_graph_pass_begin(&context, graph, postProcessPass))
+        {
+            RenderGraphPass *pass = graph->passes + postProcessPass;
+            RenderGraphResource *sceneResource = graph->resources + pass->reads[0];
+            
+            float postProcessData[] =
+            {
+                context.time,
+                0.2f, // speed
+                8.0, // frequency
+                0.1f, // amplitude
+                (float)BENCHMARK_WIDTH / sceneResource->textureWidth, // uv scale x
+                (float)BENCHMARK_HEIGHT / sceneResource->textureHeight, // uv scale y
+                0, 0 // padding
+            };
+            
+            render_pass(&context,
+                        cmdbuf,
+                        context.pipelinePostProcess,
+                        render_graph_texture(graph, pass->reads[0]),
+                        SAMPLER_POINT,
+                        pass->target,
+                        0, // buffers
+                        0, // draws
+                        0, // draw count
+                        0, // matrix
+                        postProcessData);
+            
+            if (captureFrame)
+            {
+                readback_capture(&context, &context.readback,
+                                 sceneResource->texture, BENCHMARK_WIDTH, BENCHMARK_HEIGHT,
+                                 SCENE_TARGET_FORMAT, "benchmark_scene");
+            }
+            
+            render_graph_pass_end(&context, graph, postProcessPass);
+        }
+        
+        if (captureFrame)
+        {
+            readback_capture(&context, &context.readback,
+                             output, BENCHMARK_WIDTH, BENCHMARK_HEIGHT,
+                             SCENE_TARGET_FORMAT, "benchmark_frame");
+        }
+        
+        target_pool_trim(&context, &context.targetPool, TARGET_POOL_MAX_UNUSED_FRAMES);
+        frame_timing_mark(&context.timing, PHASE_RECORD);
+        
+        frame_timing_submit(&context.timing, cmdbuf);
+        readback_submit(&context.readback);
+        context.frameIndex++;
+        frame_timing_mark(&context.timing, PHASE_SUBMIT);
+        frame_timing_end(&context.timing);
     }
     
-    // Bind our graphics pipeline and draw a triangle
-    SDL_BindGPUGraphicsPipeline(renderPass, pipeline);
+    // Measured until the GPU has finished the last frame
+    frame_timing_poll_fences(&context, &context.timing, 0);
+    double seconds = (SDL_GetTicksNS() - startTime) / 1e9;
+    double uploadBytes = (double)config.frameCount * config.quadCount *
+        vertex_format_quad_size(vertexFormat);
     
-    // Texture and Sampler
-    SDL_BindGPUFragmentSamplers(renderPass,
-                                0, // first slot
-                                &(SDL_GPUTextureSamplerBinding)
-                                {
-                                    texture,
-                                    context->samplerPoint
-                                },
-                                1);
+    // One line with everything, for scripts to pick up
+    SDL_Log("benchmark,quads=%u,textures=%u,post=%d,frames=%u,workers=%u,"
+            "fps=%.2f,quads_per_sec=%.0f,upload_mb_per_sec=%.2f",
+            config.quadCount, config.textureCount, config.postProcess,
+            config.frameCount, context.jobs.workerCount,
+            config.frameCount / seconds,
+            (double)config.quadCount * config.frameCount / seconds,
+            uploadBytes / (1024.0 * 1024.0) / seconds);
+    frame_timing_write_csv(&context.timing);
     
-    if (buffers)
+    // A golden mismatch fails the run
+    release_readback(&context, &context.readback);
+    int result = SDL_GetAtomicInt(&context.readback.mismatchCount) ? 1 : 0;
+    
+    release_job_system(&context.jobs);
+    SDL_free(sprites);
+    
+    for (Uint32 textureIndex = 0; textureIndex < config.textureCount; ++textureIndex)
     {
-        SDL_BindGPUVertexBuffers(renderPass, 0,
-                                 &(SDL_GPUBufferBinding){ buffers->vertex, 0 },
-                                 1);
-        
-        SDL_BindGPUIndexBuffer(renderPass,
-                               &(SDL_GPUBufferBinding){ buffers->index, 0 },
-                               SDL_GPU_INDEXELEMENTSIZE_32BIT);
-        
-        SDL_DrawGPUIndexedPrimitives(renderPass, buffers->indexCount, 1, 0, 0, 0);
+        SDL_ReleaseGPUTexture(context.device, textures[textureIndex]);
     }
-    else
+    SDL_ReleaseGPUTexture(context.device, output);
+    SDL_ReleaseGPUTransferBuffer(context.device, context.transferBufferTexture);
+    for (int i = 0; i < SAMPLER_COUNT; ++i)
     {
-        // Assume it's a post-process which has in-shader vertices
-        SDL_DrawGPUPrimitives(renderPass, 6, 1, 0, 0);
+        SDL_ReleaseGPUSampler(context.device, context.samplers[i]);
     }
     
-    // End the render pass
-    SDL_EndGPURenderPass(renderPass);
+    release_target_pool(&context, &context.targetPool);
+    upload_queue_flush_retired(&context);
+    SDL_free(context.uploads.uploads);
+    SDL_free(context.uploads.retiredTextures);
+    SDL_free(context.uploads.retiredTransfers);
+    release_buffers(&context, &context.buffersDynamic);
+    release_startup(&context);
+    release_pipeline_cache(&context);
+    release_shader_bundle(&context);
+    release_tracer(&context.tracer);
+    
+    SDL_DestroyGPUDevice(context.device);
+    SDL_Quit();
+    return result;
 }
 
 // Main entry point
@@ -476,7 +5797,14 @@ main(int argc, char **argv)
     Context context = {0};
     bool quit = false;
     bool minimized = false;
-    float lastTime = 0;
+    Uint64 lastTime = 0;
+    
+    // Headless runs don't open a window at all
+    BenchmarkConfig benchmark = benchmark_config(argc, argv);
+    if (benchmark.enabled)
+    {
+        return run_benchmark(benchmark, argc, argv);
+    }
     
     // Init SDL
     assert(SDL_Init(SDL_INIT_VIDEO));
@@ -495,64 +5823,111 @@ main(int argc, char **argv)
     context.winHeight = 600;
     context.window = SDL_CreateWindow("Minimal SDL3 GPU Example",
                                       context.winWidth, context.winHeight,
-                                      SDL_WINDOW_VULKAN);
+                                      SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
     assert(context.window);
     
     // Associate window with GPU Device
     assert(SDL_ClaimWindowForGPUDevice(context.device, context.window));
     
-    // Create pipelines
-    create_pipeline_dynamic(&context);
-    create_pipeline_postprocess(&context);
+    // Present mode, frames in flight and frame limit
+    frame_pacing_init(&context.pacing, argc, argv);
+    frame_pacing_apply(&context);
+    
+    // Per-phase CPU timings, and optionally GPU completion, written on
+    // exit or with F2
+    frame_timing_init(&context, argc, argv, "frame_timings.csv");
+    
+    // Frames captured with F3 are written out on a worker thread
+    create_readback(&context.readback, argc, argv);
+    
+    // --packed writes the 16-byte vertex layout instead of full floats,
+    // --instanced adds the instanced pipeline and has the batch upload one
+    // record per sprite for it, and --gpu-cull adds a large sprite set
+    // that is culled in a compute pass and drawn indirectly
+    VertexFormat vertexFormat = VERTEX_FORMAT_FLOAT;
+    bool instanced = false;
+    bool gpuCulling = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], "--packed") == 0) vertexFormat = VERTEX_FORMAT_PACKED;
+        else if (SDL_strcmp(argv[i], "--instanced") == 0) instanced = true;
+        else if (SDL_strcmp(argv[i], "--gpu-cull") == 0) gpuCulling = true;
+    }
+    VertexFormat batchFormat = instanced ? VERTEX_FORMAT_INSTANCE : vertexFormat;
+    
+    // Every shader comes out of one file, read asynchronously. The
+    // pipelines are created on worker threads once it arrives while the
+    // main thread carries on and presents frames.
+    create_pipeline_cache(&context);
+    startup_begin(&context, "shaders/shaders.pak");
+    
+    startup_add_graphics(&context, &context.pipelineDynamic,
+                         pipeline_sprite_desc(vertexFormat, BLEND_NONE));
+    if (instanced || gpuCulling)
+    {
+        startup_add_graphics(&context, &context.pipelineInstanced,
+                             pipeline_sprite_desc(VERTEX_FORMAT_INSTANCE, BLEND_NONE));
+    }
+    startup_add_graphics(&context, &context.pipelinePostProcess,
+                         pipeline_postprocess_desc(&context));
+    
+    // The blended variant the atlas sprites are drawn with
+    startup_add_graphics(&context, &context.pipelineBlended,
+                         pipeline_sprite_desc(batchFormat, BLEND_ALPHA));
     
     Uint32 maxQuadCount = 4096;
     
     // Create dynamic buffers
     context.buffersDynamic =
         create_buffers(&context,
-                       sizeof(Vertex) * 4 * maxQuadCount,
-                       sizeof(Uint32) * 6 * maxQuadCount);
+                       vertex_format_quad_size(batchFormat) * maxQuadCount,
+                       maxQuadCount,
+                       0); // frame count, defaults to frames in flight
     
-    // Create Point Sampler
-    context.samplerPoint =
-        SDL_CreateGPUSampler(context.device,
-                             &(SDL_GPUSamplerCreateInfo)
-                             {
-                                 SDL_GPU_FILTER_NEAREST,
-                                 SDL_GPU_FILTER_NEAREST,
-                                 SDL_GPU_SAMPLERMIPMAPMODE_NEAREST,
-                                 SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
-                                 SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
-                                 SDL_GPU_SAMPLERADDRESSMODE_CLAMP_TO_EDGE,
-                                 0, // mip lod bias
-                                 0, // max anisotropic
-                                 SDL_GPU_COMPAREOP_GREATER,
-                                 0, // min lod
-                                 0, // max lod
-                                 false, // enable anisotropic
-                                 false // enable compare
-                             });
+    // Culling many sprites on the GPU, drawn with the instanced pipeline
+    Uint32 cullSpriteCount = 200000;
     
-    // Create Post-process Texture
-    context.texturePostProcess =
-        SDL_CreateGPUTexture(context.device,
-                             &(SDL_GPUTextureCreateInfo)
-                             {
-                                 SDL_GPU_TEXTURETYPE_2D,
-                                 SDL_GPU_TEXTUREFORMAT_B8G8R8A8_UNORM,
-                                 SDL_GPU_TEXTUREUSAGE_SAMPLER |
-                                     SDL_GPU_TEXTUREUSAGE_COLOR_TARGET,
-                                 context.winWidth,
-                                 context.winHeight,
-                                 1, // layer count
-                                 1, // mip levels
-                                 SDL_GPU_SAMPLECOUNT_1
-                             });
+    if (gpuCulling)
+    {
+        startup_add_compute(&context, &context.pipelineCull, "cull");
+        
+        context.cull = create_cull_buffers(&context, cullSpriteCount);
+        
+        // Scatter sprites over an area much larger than the window so
+        // most of them are off-screen
+        SpriteInstance *sprites =
+            SDL_malloc(cullSpriteCount * sizeof(SpriteInstance));
+        assert(sprites);
+        
+        for (Uint32 spriteIndex = 0; spriteIndex < cullSpriteCount; ++spriteIndex)
+        {
+            sprites[spriteIndex] = (SpriteInstance)
+            {
+                (SDL_randf() * 20.0f - 10.0f) * context.winWidth,
+                (SDL_randf() * 20.0f - 10.0f) * context.winHeight,
+                16.0f, 16.0f,
+                0, 0, 0xFFFF, 0xFFFF,
+                0xFF, 0xFF, 0xFF, 0xFF,
+                SDL_randf() * 6.2831853f
+            };
+        }
+        
+        update_cull_sprites(&context, &context.cull, sprites, cullSpriteCount);
+        SDL_free(sprites);
+    }
+    
+    // Create the samplers draws can choose from
+    create_samplers(&context);
+    
+    // With --dynamic-resolution, hold the refresh rate under heavy fill by
+    // drawing the scene at a lower resolution
+    dynamic_resolution_init(&context, argc, argv);
     
     // Texture
     Uint32 texWidth = 2;
     Uint32 texHeight = 2;
-    create_texture(&context, texWidth, texHeight);
+    Uint32 texMipLevels = texture_mip_count(texWidth, texHeight);
+    create_texture(&context, texWidth, texHeight, texMipLevels);
     
     Uint32 texData[] =
     {
@@ -563,15 +5938,76 @@ main(int argc, char **argv)
     update_texture(&context,
                    context.texture,
                    context.transferBufferTexture,
-                   texWidth, texHeight, texData);
+                   texWidth, texHeight, texMipLevels, texData);
+    
+    // Atlas with a handful of generated sprite images, right click
+    // swaps the oldest one out for a new one of a different size
+    #define ATLAS_DEMO_SPRITE_COUNT 8
+    #define ATLAS_DEMO_MAX_SIZE 48
+    context.atlas = create_atlas(&context, 256, 256, 64);
+    
+    Uint32 atlasImage[ATLAS_DEMO_MAX_SIZE * ATLAS_DEMO_MAX_SIZE];
+    Uint32 atlasSprites[ATLAS_DEMO_SPRITE_COUNT];
+    Uint32 atlasOldest = 0;
+    
+    for (Uint32 i = 0; i < ATLAS_DEMO_SPRITE_COUNT; ++i)
+    {
+        Uint32 size = 8 + (i * 5) % (ATLAS_DEMO_MAX_SIZE - 8);
+        Uint32 color = 0xFF000000 | (0x3F << ((i % 3) * 8)) * (1 + i % 4);
+        for (Uint32 p = 0; p < size * size; ++p)
+        {
+            atlasImage[p] = ((p % size + p / size) % 2) ? color : 0xFFFFFFFF;
+        }
+        
+        atlasSprites[i] = atlas_add(&context, &context.atlas, size, size, atlasImage);
+        assert(atlasSprites[i] != ATLAS_INVALID_REGION);
+    }
+    
+    // Stream every BMP in the textures folder without blocking the frame
+    Uint32 streamRingSize = 32 * 1024 * 1024;
+    Uint32 streamBytesPerFrame = 1024 * 1024;
+    create_texture_streamer(&context, streamRingSize, streamBytesPerFrame);
+    
+    Uint32 streamHandles[16];
+    Uint32 streamCount = 0;
+    {
+        char texturesPath[512] = {0};
+        SDL_strlcat(texturesPath, context.basePath, sizeof(texturesPath));
+        SDL_strlcat(texturesPath, "textures", sizeof(texturesPath));
+        
+        int fileCount = 0;
+        char **files = SDL_GlobDirectory(texturesPath, "*.bmp", 0, &fileCount);
+        for (int i = 0; files && i < fileCount && streamCount < SDL_arraysize(streamHandles); ++i)
+        {
+            char fullPath[512];
+            SDL_snprintf(fullPath, sizeof(fullPath), "%s/%s", texturesPath, files[i]);
+            
+            Uint32 handle = texture_stream_request(&context.streamer, fullPath);
+            if (handle != STREAM_INVALID_HANDLE) streamHandles[streamCount++] = handle;
+        }
+        SDL_free(files);
+    }
     
     float lastMouseX = 0;
     float lastMouseY = 0;
     bool mouseLeftDown = false;
+    bool captureRequested = false;
+    lastTime = SDL_GetTicksNS();
     
     // Update and render loop
     while (!quit)
     {
+        // Block until an event arrives when there's nothing new to draw,
+        // but keep polling captures that are still downloading
+        if (minimized || !frame_pacing_needs_frame(&context))
+        {
+            SDL_WaitEventTimeout(NULL, readback_pending(&context.readback) ? 1 : -1);
+        }
+        
+        frame_timing_begin(&context.timing);
+        frame_timing_poll_fences(&context, &context.timing, MAX_TIMED_FENCES);
+        readback_update(&context, &context.readback, false);
+        
         // Poll events
         SDL_Event evt;
         while (SDL_PollEvent(&evt))
@@ -591,24 +6027,72 @@ main(int argc, char **argv)
                 case SDL_EVENT_WINDOW_RESTORED:
                 {
                     minimized = false;
+                    context.pacing.dirty = true;
+                } break;
+                
+                case SDL_EVENT_WINDOW_EXPOSED:
+                case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+                {
+                    // The window contents were lost or have to be redrawn
+                    context.pacing.dirty = true;
                 } break;
                 
                 case SDL_EVENT_MOUSE_MOTION:
                 {
                     lastMouseX = evt.motion.x;
                     lastMouseY = evt.motion.y;
+                    
+                    // The second sprite follows the mouse while held
+                    if (mouseLeftDown) context.pacing.dirty = true;
                 } break;
                 
                 case SDL_EVENT_MOUSE_BUTTON_DOWN:
                 {
+                    context.pacing.dirty = true;
                     if (evt.button.button == 1)
                     {
                         mouseLeftDown = true;
                     }
+                    else if (evt.button.button == 3)
+                    {
+                        Uint32 size = 8 + SDL_rand(ATLAS_DEMO_MAX_SIZE - 8);
+                        Uint32 color = 0xFF000000 | (Uint32)SDL_rand(0x01000000);
+                        for (Uint32 p = 0; p < size * size; ++p)
+                        {
+                            atlasImage[p] = ((p % size + p / size) % 2) ? color : 0xFFFFFFFF;
+                        }
+                        
+                        // A slot whose image didn't fit is left empty
+                        if (atlasSprites[atlasOldest] != ATLAS_INVALID_REGION)
+                        {
+                            atlas_remove(&context.atlas, atlasSprites[atlasOldest]);
+                        }
+                        atlasSprites[atlasOldest] =
+                            atlas_add(&context, &context.atlas, size, size, atlasImage);
+                        if (atlasSprites[atlasOldest] == ATLAS_INVALID_REGION)
+                        {
+                            SDL_Log("Atlas has no room for a %ux%u image", size, size);
+                        }
+                        atlasOldest = (atlasOldest + 1) % ATLAS_DEMO_SPRITE_COUNT;
+                    }
+                } break;
+                
+                case SDL_EVENT_KEY_DOWN:
+                {
+                    if (evt.key.key == SDLK_F2 && !evt.key.repeat)
+                    {
+                        frame_timing_write_csv(&context.timing);
+                    }
+                    else if (evt.key.key == SDLK_F3 && !evt.key.repeat)
+                    {
+                        captureRequested = true;
+                        context.pacing.dirty = true;
+                    }
                 } break;
                 
                 case SDL_EVENT_MOUSE_BUTTON_UP:
                 {
+                    context.pacing.dirty = true;
                     if (evt.button.button == 1)
                     {
                         mouseLeftDown = false;
@@ -620,138 +6104,395 @@ main(int argc, char **argv)
         // Break out of update and render loop if we just quit
         if (quit) break;
         
-        // If the window is not minimized
-        if (!minimized)
+        frame_timing_mark(&context.timing, PHASE_EVENTS);
+        
+        // Pipelines are created on worker threads at startup. That needs
+        // no GPU work, so it moves on even when no frame is drawn.
+        if (!context.startup.ready && startup_update(&context, false))
+        {
+            // Sprites are batched into the dynamic buffers, flushing when full
+            sprite_batch_init(&context.batch,
+                              &context.buffersDynamic,
+                              batchFormat,
+                              instanced ?
+                                  context.pipelineInstanced :
+                                  context.pipelineDynamic);
+            
+            // The shader's local size has to match the dispatch in cull_pass
+            assert(!context.pipelineCull ||
+                   shader_bundle_find(&context, "cull")->threadCount == CULL_THREAD_COUNT);
+        }
+        
+        // If the window is not minimized and needs redrawing
+        if (!minimized && frame_pacing_needs_frame(&context))
         {
-            // Calculate delta time for the frame
-            float newTime = SDL_GetTicks() / 1000.0f;
-            context.deltaTime = newTime - lastTime;
-            lastTime = newTime;
-            context.time += context.deltaTime;
+            // Acquire a command buffer to render with
+            SDL_GPUCommandBuffer* cmdbuf =
+                SDL_AcquireGPUCommandBuffer(context.device);
+            assert(cmdbuf);
+            
+            // Acquire a swapchain image to render into. Without waiting we
+            // get no image while the GPU is frames in flight behind.
+            SDL_GPUTexture* swapchainTexture;
+            Uint32 swapchainWidth = 0;
+            Uint32 swapchainHeight = 0;
+            Uint64 acquireZone = trace_begin(&context.tracer);
+            if (context.pacing.nonBlockingAcquire)
+            {
+                assert(SDL_AcquireGPUSwapchainTexture(cmdbuf,
+                                                      context.window,
+                                                      &swapchainTexture,
+                                                      &swapchainWidth,
+                                                      &swapchainHeight));
+            }
+            else
+            {
+                assert(SDL_WaitAndAcquireGPUSwapchainTexture(cmdbuf,
+                                                             context.window,
+                                                             &swapchainTexture,
+                                                             &swapchainWidth,
+                                                             &swapchainHeight));
+            }
             
-            // Update data
+            trace_end(&context.tracer, "acquire", acquireZone);
+            frame_timing_mark(&context.timing, PHASE_ACQUIRE);
+            
+            // If we got a swapchain image
+            if (swapchainTexture)
             {
-                // Vertex data
-                float s = 500.0f;
-                if (!mouseLeftDown)
+                // Calculate delta time for the frame, skipped frames
+                // count towards the next one
+                Uint64 newTime = SDL_GetTicksNS();
+                context.deltaTime = (newTime - lastTime) / 1e9f;
+                lastTime = newTime;
+                
+                // In idle mode the time between frames is mostly spent
+                // waiting, so it neither animates nor says anything about
+                // the GPU load
+                if (!context.pacing.idle)
                 {
-                    Vertex vertices[] =
-                    {
-                        {0, 0,    0, 0,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {s, 0,    1, 0,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {s, s,    1, 1,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {0, s,    0, 1,    1.0f, 1.0f, 1.0f, 1.0f}
-                    };
+                    context.time += context.deltaTime;
+                    dynamic_resolution_update(&context.dynamicResolution, context.deltaTime);
+                }
+                
+                // Follow the swapchain, everything sized from the window
+                // (the projection, the scene target) picks this up
+                context.winWidth = swapchainWidth;
+                context.winHeight = swapchainHeight;
+                
+                frame_timing_mark(&context.timing, PHASE_UPDATE);
+                
+                SDL_FColor clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+                
+                // Queue this frame's share of streamed texture data, then
+                // record the pending uploads before any rendering
+                texture_streamer_update(&context, &context.streamer);
+                upload_queue_flush(&context, cmdbuf);
+                frame_timing_mark(&context.timing, PHASE_UPLOAD);
+                
+                // Pipelines are created on worker threads at startup
+                bool pipelinesReady = context.startup.ready;
+                
+                // Declare the frame's passes. The graph works out the load
+                // and store ops, and when the scene target has to exist.
+                RenderGraph *graph = &context.graph;
+                render_graph_begin(graph);
+                
+                Uint32 swapchain =
+                    render_graph_import(graph, "swapchain", swapchainTexture, true);
+                
+                // The swapchain image can't be read back, so a captured
+                // frame is drawn into a pooled texture and blitted across
+                SDL_GPUTextureFormat swapchainFormat =
+                    SDL_GetGPUSwapchainTextureFormat(context.device, context.window);
+                SDL_GPUTexture *captureTexture = 0;
+                Uint32 output = swapchain;
+                if (captureRequested && pipelinesReady)
+                {
+                    Uint32 captureWidth, captureHeight;
+                    captureTexture = target_pool_acquire(&context, &context.targetPool,
+                                                         context.winWidth, context.winHeight,
+                                                         swapchainFormat,
+                                                         SDL_GPU_TEXTUREUSAGE_COLOR_TARGET |
+                                                             SDL_GPU_TEXTUREUSAGE_SAMPLER,
+                                                         &captureWidth, &captureHeight);
+                    output = render_graph_import(graph, "capture", captureTexture, true);
+                    captureRequested = false;
+                }
+                
+                Uint32 clearPass = RENDER_GRAPH_NONE;
+                Uint32 spritePass = RENDER_GRAPH_NONE;
+                Uint32 cullDrawPass = RENDER_GRAPH_NONE;
+                Uint32 postProcessPass = RENDER_GRAPH_NONE;
+                
+                if (!pipelinesReady)
+                {
+                    // Nothing to draw with yet, get a frame up anyway
+                    clearPass = render_graph_add_pass(graph, "clear", swapchain,
+                                                      RENDER_GRAPH_CLEAR, clearColor);
+                }
+                else
+                {
+                    Uint32 scene =
+                        render_graph_transient(graph, "scene",
+                                               context.winWidth, context.winHeight,
+                                               SCENE_TARGET_FORMAT,
+                                               SDL_GPU_TEXTUREUSAGE_SAMPLER |
+                                                   SDL_GPU_TEXTUREUSAGE_COLOR_TARGET);
                     
-                    size_t vertexSize = sizeof(vertices);
+                    spritePass = render_graph_add_pass(graph, "sprites", scene,
+                                                       RENDER_GRAPH_CLEAR, clearColor);
                     
-                    // Index data
-                    Uint32 indices[] = 
+                    if (context.pipelineCull)
                     {
-                        0, 1, 2,
-                        2, 3, 0
-                    };
+                        cullDrawPass = render_graph_add_pass(graph, "cull", scene,
+                                                             RENDER_GRAPH_PRESERVE, clearColor);
+                    }
                     
-                    update_buffers(&context,
-                                   &context.buffersDynamic,
-                                   vertices, sizeof(vertices),
-                                   indices, sizeof(indices));
+                    // The full-screen quad covers the whole window
+                    postProcessPass = render_graph_add_pass(graph, "postprocess", output,
+                                                            RENDER_GRAPH_OVERWRITE, clearColor);
+                    render_graph_read(graph, postProcessPass, scene);
                 }
-                else
+                
+                render_graph_compile(graph);
+                
+                // The scene target is at least window sized, the scene only
+                // fills the top left of it at the current scale
+                float sceneScale = context.dynamicResolution.scale;
+                Uint32 sceneWidth = SDL_max((Uint32)(context.winWidth * sceneScale), 1);
+                Uint32 sceneHeight = SDL_max((Uint32)(context.winHeight * sceneScale), 1);
+                
+                if (render_graph_pass_begin(&context, graph, clearPass))
+                {
+                    render_pass(&context,
+                                cmdbuf,
+                                0, // pipeline
+                                0, // texture
+                                SAMPLER_POINT,
+                                graph->passes[clearPass].target,
+                                0, // buffers
+                                0, // draws
+                                0, // draw count
+                                0, // matrix
+                                0); // post-process data
+                    
+                    render_graph_pass_end(&context, graph, clearPass);
+                }
+                
+                float matrix[] =
+                {
+                    2.0f / (float)context.winWidth, 0, 0, -1,
+                    0, -2.0f / (float)context.winHeight, 0, 1,
+                    0, 0, 1, 0,
+                    0, 0, 0, 1
+                };
+                
+                // Render sprites to the scene target
+                if (render_graph_pass_begin(&context, graph, spritePass))
                 {
-                    Vertex vertices[] =
+                    SDL_FColor white = { 1.0f, 1.0f, 1.0f, 1.0f };
+                    float s = 500.0f;
+                    
+                    sprite_batch_begin(&context,
+                                       &context.batch,
+                                       cmdbuf,
+                                       render_graph_scaled_target(graph, spritePass,
+                                                                  sceneWidth, sceneHeight),
+                                       matrix);
+                    
+                    sprite_batch_push_quad(&context, &context.batch,
+                                           context.texture,
+                                           0, 0, s, s,
+                                           0, 0, 1, 1,
+                                           white);
+                    
+                    if (mouseLeftDown)
                     {
-                        {0, 0,    0, 0,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {s, 0,    1, 0,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {s, s,    1, 1,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {0, s,    0, 1,    1.0f, 1.0f, 1.0f, 1.0f},
-                        
-                        {lastMouseX + 0, lastMouseY + 0,    0, 0,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {lastMouseX + s, lastMouseY + 0,    1, 0,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {lastMouseX + s, lastMouseY + s,    1, 1,    1.0f, 1.0f, 1.0f, 1.0f},
-                        {lastMouseX + 0, lastMouseY + s,    0, 1,    1.0f, 1.0f, 1.0f, 1.0f}
-                    };
+                        sprite_batch_push_quad(&context, &context.batch,
+                                               context.texture,
+                                               lastMouseX, lastMouseY, s, s,
+                                               0, 0, 1, 1,
+                                               white);
+                    }
                     
-                    size_t vertexSize = sizeof(vertices);
+                    // Atlas sprites all share one texture, so one draw
+                    sprite_batch_set_pipeline(&context.batch, context.pipelineBlended);
+                    float atlasX = 520.0f;
+                    for (Uint32 i = 0; i < ATLAS_DEMO_SPRITE_COUNT; ++i)
+                    {
+                        if (atlasSprites[i] == ATLAS_INVALID_REGION) continue;
+                        
+                        AtlasRegion *region = context.atlas.regions + atlasSprites[i];
+                        float w = region->width * 2.0f;
+                        float h = region->height * 2.0f;
+                        
+                        sprite_batch_push_quad(&context, &context.batch,
+                                               context.atlas.texture,
+                                               atlasX, 20.0f, w, h,
+                                               region->u0, region->v0,
+                                               region->u1, region->v1,
+                                               white);
+                        atlasX += w + 4.0f;
+                    }
                     
-                    // Index data
-                    Uint32 indices[] = 
+                    // Streamed textures, the checker stands in until loaded.
+                    // They're drawn smaller than they are, so use the mips.
+                    sprite_batch_set_sampler(&context.batch, SAMPLER_TRILINEAR);
+                    for (Uint32 i = 0; i < streamCount; ++i)
                     {
-                        0, 1, 2, 2, 3, 0,
-                        4, 5, 6, 6, 7, 4
-                    };
+                        SDL_GPUTexture *texture =
+                            texture_stream_get(&context.streamer,
+                                               streamHandles[i],
+                                               context.texture);
+                        
+                        sprite_batch_push_quad(&context, &context.batch,
+                                               texture,
+                                               520.0f + i * 68.0f, 120.0f, 64.0f, 64.0f,
+                                               0, 0, 1, 1,
+                                               white);
+                    }
                     
-                    update_buffers(&context,
-                                   &context.buffersDynamic,
-                                   vertices, sizeof(vertices),
-                                   indices, sizeof(indices));
+                    sprite_batch_end(&context, &context.batch);
+                    
+                    render_graph_pass_end(&context, graph, spritePass);
                 }
-            }
-            
-            // Acquire a command buffer to render with
-            SDL_GPUCommandBuffer* cmdbuf =
-                SDL_AcquireGPUCommandBuffer(context.device);
-            assert(cmdbuf);
-            
-            // Acquire a swapchain image to render into
-            SDL_GPUTexture* swapchainTexture;
-            assert(SDL_WaitAndAcquireGPUSwapchainTexture(cmdbuf,
-                                                         context.window,
-                                                         &swapchainTexture,
-                                                         0, 0));
-            
-            // If we got a swapchain image
-            if (swapchainTexture)
-            {
-                SDL_FColor clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
                 
-                // Render dynamic buffers to post-process texture
+                // Cull on the GPU and draw whatever survived on top
+                if (render_graph_pass_begin(&context, graph, cullDrawPass))
                 {
-                    // Update uniform
-                    float matrix[] =
+                    cull_pass(&context, cmdbuf, &context.cull, matrix);
+                    
+                    BatchDraw cullDraw =
                     {
-                        2.0f / (float)context.winWidth, 0, 0, -1,
-                        0, -2.0f / (float)context.winHeight, 0, 1,
-                        0, 0, 1, 0,
-                        0, 0, 0, 1
+                        .pipeline = context.pipelineInstanced,
+                        .texture = context.texture,
+                        .indirect = context.cull.indirect
                     };
                     
-                    // Render to texture
                     render_pass(&context,
                                 cmdbuf,
-                                context.pipelineDynamic,
-                                context.texture, // texture
-                                context.texturePostProcess, // target
-                                clearColor,
-                                &context.buffersDynamic,
+                                0, // pipeline
+                                0, // texture
+                                SAMPLER_POINT,
+                                render_graph_scaled_target(graph, cullDrawPass,
+                                                           sceneWidth, sceneHeight),
+                                &context.cull.visible,
+                                &cullDraw,
+                                1, // draw count
                                 matrix,
                                 0); // post-process data
+                    
+                    render_graph_pass_end(&context, graph, cullDrawPass);
                 }
                 
-                // Render post-process texture to screen
+                // Render the scene to the screen with the post-process effect
+                if (render_graph_pass_begin(&context, graph, postProcessPass))
                 {
+                    RenderGraphPass *pass = graph->passes + postProcessPass;
+                    RenderGraphResource *scene = graph->resources + pass->reads[0];
+                    
+                    // Upscaled from the part of the scene target in use
                     float postProcessData[] =
                     {
                         context.time,
                         0.2f, // speed
                         8.0, // frequency
-                        0.1f // amplitude
+                        0.1f, // amplitude
+                        (float)sceneWidth / scene->textureWidth, // uv scale x
+                        (float)sceneHeight / scene->textureHeight, // uv scale y
+                        0, 0 // padding
                     };
                     
-                    // Render texture to screen
                     render_pass(&context,
                                 cmdbuf,
                                 context.pipelinePostProcess,
-                                context.texturePostProcess, // texture
-                                swapchainTexture, // target
-                                clearColor,
+                                render_graph_texture(graph, pass->reads[0]),
+                                (sceneScale < 1.0f) ? SAMPLER_LINEAR : SAMPLER_POINT,
+                                render_graph_scaled_target(graph, postProcessPass,
+                                                           context.winWidth,
+                                                           context.winHeight),
                                 0, // buffers
+                                0, // draws
+                                0, // draw count
                                 0, // matrix
                                 postProcessData);
+                    
+                    // Both before and after the post-process, while the
+                    // scene target is still ours
+                    if (captureTexture)
+                    {
+                        char name[READBACK_NAME_SIZE];
+                        SDL_snprintf(name, sizeof(name), "scene_%06llu",
+                                     (unsigned long long)context.frameIndex);
+                        readback_capture(&context, &context.readback,
+                                         scene->texture, sceneWidth, sceneHeight,
+                                         SCENE_TARGET_FORMAT, name);
+                        
+                        SDL_snprintf(name, sizeof(name), "frame_%06llu",
+                                     (unsigned long long)context.frameIndex);
+                        readback_capture(&context, &context.readback,
+                                         captureTexture, context.winWidth, context.winHeight,
+                                         swapchainFormat, name);
+                        
+                        SDL_BlitGPUTexture(cmdbuf,
+                                           &(SDL_GPUBlitInfo)
+                                           {
+                                               .source =
+                                               {
+                                                   .texture = captureTexture,
+                                                   .w = context.winWidth,
+                                                   .h = context.winHeight
+                                               },
+                                               .destination =
+                                               {
+                                                   .texture = swapchainTexture,
+                                                   .w = context.winWidth,
+                                                   .h = context.winHeight
+                                               },
+                                               .load_op = SDL_GPU_LOADOP_DONT_CARE,
+                                               .filter = SDL_GPU_FILTER_NEAREST
+                                           });
+                        target_pool_release(&context.targetPool, captureTexture);
+                    }
+                    
+                    render_graph_pass_end(&context, graph, postProcessPass);
+                }
+                
+                // Let go of targets nothing has asked for in a while
+                target_pool_trim(&context, &context.targetPool, TARGET_POOL_MAX_UNUSED_FRAMES);
+                
+                frame_timing_mark(&context.timing, PHASE_RECORD);
+                
+                // Submit the command buffer, with a fence when timing the GPU
+                Uint64 submitZone = trace_begin(&context.tracer);
+                frame_timing_submit(&context.timing, cmdbuf);
+                trace_end(&context.tracer, "submit", submitZone);
+                
+                // Downloads recorded this frame run after it
+                readback_submit(&context.readback);
+                context.frameIndex++;
+                context.pacing.dirty = false;
+                
+                frame_timing_mark(&context.timing, PHASE_SUBMIT);
+                frame_timing_end(&context.timing);
+                
+                if (context.frameIndex == 1)
+                {
+                    SDL_Log("First frame after %.2f ms",
+                            (SDL_GetTicksNS() - context.startup.startTime) / 1000000.0);
                 }
                 
-                // Submit the command buffer
-                SDL_SubmitGPUCommandBuffer(cmdbuf);
+                frame_pacing_wait(&context.pacing);
+            }
+            else if (context.pacing.nonBlockingAcquire)
+            {
+                // The GPU is still busy, go round again and poll events
+                // rather than block. Sleep a little first, or this spins a
+                // core until a frame finishes, and forever when hidden.
+                context.pacing.skippedFrames++;
+                SDL_CancelGPUCommandBuffer(cmdbuf);
+                SDL_WaitEventTimeout(NULL, 1);
             }
             else
             {
@@ -761,21 +6502,37 @@ main(int argc, char **argv)
                 SDL_CancelGPUCommandBuffer(cmdbuf);
             }
         }
-        else
-        {
-            // Window is minimized, sleep for a frame to avoid high CPU usage
-            SDL_Delay(1000.0f / 60);
-        }
     }
     
-    // Release sampler
-    SDL_ReleaseGPUSampler(context.device, context.samplerPoint);
+    frame_timing_poll_fences(&context, &context.timing, 0);
+    frame_timing_write_csv(&context.timing);
+    release_readback(&context, &context.readback);
+    
+    if (context.pacing.nonBlockingAcquire)
+    {
+        SDL_Log("Skipped %llu frames waiting for a swapchain image",
+                (unsigned long long)context.pacing.skippedFrames);
+    }
+    
+    // Release samplers
+    for (int i = 0; i < SAMPLER_COUNT; ++i)
+    {
+        SDL_ReleaseGPUSampler(context.device, context.samplers[i]);
+    }
     
-    // Release framebuffer texture
-    SDL_ReleaseGPUTexture(context.device, context.texturePostProcess);
+    // Release render targets
+    release_target_pool(&context, &context.targetPool);
     
     // Release texture
     SDL_ReleaseGPUTexture(context.device, context.texture);
+    release_atlas(&context, &context.atlas);
+    release_texture_streamer(&context, &context.streamer);
+    
+    // Release anything still waiting on a flush
+    upload_queue_flush_retired(&context);
+    SDL_free(context.uploads.uploads);
+    SDL_free(context.uploads.retiredTextures);
+    SDL_free(context.uploads.retiredTransfers);
     
     // Release buffers
     release_buffers(&context, &context.buffersDynamic);
@@ -783,8 +6540,19 @@ main(int argc, char **argv)
     // Release Transfer buffers
     SDL_ReleaseGPUTransferBuffer(context.device, context.transferBufferTexture);
     
-    SDL_ReleaseGPUGraphicsPipeline(context.device, context.pipelineDynamic);
-    SDL_ReleaseGPUGraphicsPipeline(context.device, context.pipelinePostProcess);
+    // Join the startup workers before looking at anything they create
+    release_startup(&context);
+    
+    if (context.pipelineCull)
+    {
+        release_cull_buffers(&context, &context.cull);
+        SDL_ReleaseGPUComputePipeline(context.device, context.pipelineCull);
+    }
+    
+    // Release every graphics pipeline and shader
+    release_pipeline_cache(&context);
+    release_shader_bundle(&context);
+    release_tracer(&context.tracer);
     
     SDL_ReleaseWindowFromGPUDevice(context.device, context.window);
     SDL_DestroyWindow(context.window);
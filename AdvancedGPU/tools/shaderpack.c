@@ -0,0 +1,242 @@
+// Packs compiled SPIR-V shaders and their resource counts into one file
+// that AdvancedGPU loads with a single read.
+//
+// Usage: shaderpack <manifest> <output>
+//
+// Every non-comment line of the manifest is:
+// name file stage samplers uniforms ro-storage rw-storage threads
+// where stage is vertex, fragment or compute and file is relative to
+// the manifest.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Must match ShaderBundleHeader and ShaderBundleEntry in main.c
+#define SHADER_BUNDLE_MAGIC 0x4B504853 // "SHPK"
+#define SHADER_BUNDLE_VERSION 1
+#define SHADER_BUNDLE_NAME_SIZE 32
+#define SHADER_BUNDLE_ENTRY_POINT_SIZE 16
+
+enum
+{
+    SHADER_BUNDLE_STAGE_VERTEX,
+    SHADER_BUNDLE_STAGE_FRAGMENT,
+    SHADER_BUNDLE_STAGE_COMPUTE,
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t dataOffset;
+    
+} ShaderBundleHeader;
+
+typedef struct
+{
+    char name[SHADER_BUNDLE_NAME_SIZE];
+    char entryPoint[SHADER_BUNDLE_ENTRY_POINT_SIZE];
+    uint32_t stage;
+    uint32_t samplerCount;
+    uint32_t uniformCount;
+    uint32_t readOnlyStorageBufferCount;
+    uint32_t readWriteStorageBufferCount;
+    uint32_t threadCount;
+    
+    // Relative to the start of the file
+    uint32_t offset;
+    uint32_t size;
+    
+} ShaderBundleEntry;
+
+#define MAX_ENTRIES 1024
+
+typedef struct
+{
+    ShaderBundleEntry entry;
+    void *code;
+    
+} PackEntry;
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    // Sorted by name so the loader can binary search
+    const PackEntry *entryA = a;
+    const PackEntry *entryB = b;
+    return strcmp(entryA->entry.name, entryB->entry.name);
+}
+
+static void *
+read_file(const char *path, uint32_t *outSize)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    void *result = malloc(size ? size : 1);
+    if (result && fread(result, 1, size, file) != (size_t)size)
+    {
+        free(result);
+        result = 0;
+    }
+    
+    fclose(file);
+    *outSize = (uint32_t)size;
+    return result;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: shaderpack <manifest> <output>\n");
+        return 1;
+    }
+    
+    FILE *manifest = fopen(argv[1], "r");
+    if (!manifest)
+    {
+        fprintf(stderr, "Can't open %s\n", argv[1]);
+        return 1;
+    }
+    
+    // Shader files are relative to the manifest
+    char directory[512] = {0};
+    strncpy(directory, argv[1], sizeof(directory) - 1);
+    char *slash = strrchr(directory, '/');
+    char *backslash = strrchr(directory, '\\');
+    if (backslash > slash) slash = backslash;
+    if (slash) slash[1] = 0;
+    else directory[0] = 0;
+    
+    static PackEntry entries[MAX_ENTRIES];
+    uint32_t entryCount = 0;
+    
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), manifest))
+    {
+        lineNumber++;
+        
+        char name[256], file[256], stage[32];
+        uint32_t samplers, uniforms, readOnly, readWrite, threads;
+        
+        if (line[0] == '#') continue;
+        int fieldCount = sscanf(line, "%255s %255s %31s %u %u %u %u %u",
+                                name, file, stage,
+                                &samplers, &uniforms, &readOnly, &readWrite, &threads);
+        if (fieldCount <= 0) continue;
+        
+        if (fieldCount != 8 ||
+            strlen(name) >= SHADER_BUNDLE_NAME_SIZE ||
+            entryCount == MAX_ENTRIES)
+        {
+            fprintf(stderr, "%s:%d: bad entry\n", argv[1], lineNumber);
+            return 1;
+        }
+        
+        PackEntry *pack = entries + entryCount++;
+        memset(pack, 0, sizeof(*pack));
+        strcpy(pack->entry.name, name);
+        strcpy(pack->entry.entryPoint, "main");
+        pack->entry.samplerCount = samplers;
+        pack->entry.uniformCount = uniforms;
+        pack->entry.readOnlyStorageBufferCount = readOnly;
+        pack->entry.readWriteStorageBufferCount = readWrite;
+        pack->entry.threadCount = threads;
+        
+        if (strcmp(stage, "vertex") == 0)
+        {
+            pack->entry.stage = SHADER_BUNDLE_STAGE_VERTEX;
+        }
+        else if (strcmp(stage, "fragment") == 0)
+        {
+            pack->entry.stage = SHADER_BUNDLE_STAGE_FRAGMENT;
+        }
+        else if (strcmp(stage, "compute") == 0)
+        {
+            pack->entry.stage = SHADER_BUNDLE_STAGE_COMPUTE;
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown stage %s\n", argv[1], lineNumber, stage);
+            return 1;
+        }
+        
+        char path[1024];
+        snprintf(path, sizeof(path), "%s%s", directory, file);
+        pack->code = read_file(path, &pack->entry.size);
+        if (!pack->code)
+        {
+            fprintf(stderr, "%s:%d: can't read %s\n", argv[1], lineNumber, path);
+            return 1;
+        }
+    }
+    fclose(manifest);
+    
+    qsort(entries, entryCount, sizeof(PackEntry), compare_entries);
+    
+    for (uint32_t i = 1; i < entryCount; ++i)
+    {
+        if (strcmp(entries[i - 1].entry.name, entries[i].entry.name) == 0)
+        {
+            fprintf(stderr, "Duplicate shader name %s\n", entries[i].entry.name);
+            return 1;
+        }
+    }
+    
+    // Header, then the index, then the code, each blob 4-byte aligned
+    // as SPIR-V is a stream of words
+    ShaderBundleHeader header =
+    {
+        SHADER_BUNDLE_MAGIC,
+        SHADER_BUNDLE_VERSION,
+        entryCount,
+        (uint32_t)(sizeof(ShaderBundleHeader) + entryCount * sizeof(ShaderBundleEntry))
+    };
+    
+    uint32_t offset = header.dataOffset;
+    for (uint32_t i = 0; i < entryCount; ++i)
+    {
+        entries[i].entry.offset = offset;
+        offset += (entries[i].entry.size + 3) & ~3u;
+    }
+    
+    FILE *output = fopen(argv[2], "wb");
+    if (!output)
+    {
+        fprintf(stderr, "Can't open %s\n", argv[2]);
+        return 1;
+    }
+    
+    fwrite(&header, sizeof(header), 1, output);
+    for (uint32_t i = 0; i < entryCount; ++i)
+    {
+        fwrite(&entries[i].entry, sizeof(ShaderBundleEntry), 1, output);
+    }
+    for (uint32_t i = 0; i < entryCount; ++i)
+    {
+        static const uint8_t zeros[4] = {0};
+        uint32_t size = entries[i].entry.size;
+        fwrite(entries[i].code, 1, size, output);
+        fwrite(zeros, 1, ((size + 3) & ~3u) - size, output);
+        free(entries[i].code);
+    }
+    
+    if (fclose(output) != 0)
+    {
+        fprintf(stderr, "Failed writing %s\n", argv[2]);
+        return 1;
+    }
+    
+    printf("Packed %u shaders into %s (%u bytes)\n", entryCount, argv[2], offset);
+    return 0;
+}
@@ -11,7 +11,7 @@ typedef struct
     SDL_GPUBuffer *vertexBuf;
     SDL_GPUBuffer *indexBuf;
     SDL_GPUTransferBuffer *transBufVert;
-    SDL_GPUTransferBuffer *transBufInd;
+    SDL_GPUIndexElementSize indexElementSize;
     
     SDL_GPUTexture *texture;
     SDL_GPUTransferBuffer *transBufTex;
@@ -91,8 +91,17 @@ shader_load(Context* context,
 void
 create_buffers(Context *context,
                Uint32 maxSizeVertex,
-               Uint32 maxSizeIndex)
+               Uint32 maxQuadCount)
 {
+    // 16-bit indices are enough as long as every vertex can be addressed
+    bool use16Bit = maxQuadCount * 4 <= 0x10000;
+    context->indexElementSize = use16Bit ?
+        SDL_GPU_INDEXELEMENTSIZE_16BIT :
+        SDL_GPU_INDEXELEMENTSIZE_32BIT;
+    
+    Uint32 maxSizeIndex =
+        maxQuadCount * 6 * (use16Bit ? sizeof(Uint16) : sizeof(Uint32));
+    
     // Create vertex buffer
     context->vertexBuf = SDL_CreateGPUBuffer(context->device,
                                              &(SDL_GPUBufferCreateInfo)
@@ -120,35 +129,76 @@ create_buffers(Context *context,
                                         maxSizeVertex
                                     });
     
-    // Create transfer buffer for index data
-    context->transBufInd =
+    // Every quad uses the same 0,1,2,2,3,0 pattern, so the index data
+    // is built and uploaded once here instead of every frame
+    SDL_GPUTransferBuffer *transBufInd =
         SDL_CreateGPUTransferBuffer(context->device,
                                     &(SDL_GPUTransferBufferCreateInfo)
                                     {
                                         SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
                                         maxSizeIndex
                                     });
+    
+    void *destDataInd = SDL_MapGPUTransferBuffer(context->device,
+                                                 transBufInd,
+                                                 false);
+    Uint16 *indices16 = destDataInd;
+    Uint32 *indices32 = destDataInd;
+    Uint32 quadIndices[] = { 0, 1, 2, 2, 3, 0 };
+    
+    for (Uint32 quadIndex = 0; quadIndex < maxQuadCount; ++quadIndex)
+    {
+        for (Uint32 i = 0; i < SDL_arraysize(quadIndices); ++i)
+        {
+            Uint32 index = quadIndex * 4 + quadIndices[i];
+            if (use16Bit)
+            {
+                *indices16++ = (Uint16)index;
+            }
+            else
+            {
+                *indices32++ = index;
+            }
+        }
+    }
+    
+    SDL_UnmapGPUTransferBuffer(context->device, transBufInd);
+    
+    // Start command buffer and begin copy pass
+    SDL_GPUCommandBuffer *cmdBuf = SDL_AcquireGPUCommandBuffer(context->device);
+    SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdBuf);
+    
+    // Upload index data
+    SDL_UploadToGPUBuffer(copyPass,
+                          &(SDL_GPUTransferBufferLocation)
+                          {
+                              transBufInd, 0
+                          },
+                          &(SDL_GPUBufferRegion)
+                          {
+                              context->indexBuf, 0, maxSizeIndex
+                          },
+                          false);
+    
+    // End pass and submit command buffer
+    SDL_EndGPUCopyPass(copyPass);
+    SDL_SubmitGPUCommandBuffer(cmdBuf);
+    
+    // SDL keeps the transfer buffer alive until the copy is done
+    SDL_ReleaseGPUTransferBuffer(context->device, transBufInd);
 }
 
 void
 update_buffers(Context *context,
-               void *dataVert, Uint32 dataSizeVert,
-               void *dataInd, Uint32 dataSizeInd)
+               void *dataVert, Uint32 dataSizeVert)
 {
-    // Map and copy vertex data to GPU
+    // Map and copy vertex data to GPU, the quad indices are already there
     Vertex* destDataVert = SDL_MapGPUTransferBuffer(context->device,
                                                     context->transBufVert,
                                                     false);
     memcpy(destDataVert, dataVert, dataSizeVert);
     SDL_UnmapGPUTransferBuffer(context->device, context->transBufVert);
     
-    // Map and copy index data to GPU
-    Uint32* destDataInd = SDL_MapGPUTransferBuffer(context->device,
-                                                   context->transBufInd,
-                                                   false);
-    memcpy(destDataInd, dataInd, dataSizeInd);
-    SDL_UnmapGPUTransferBuffer(context->device, context->transBufInd);
-    
     // Start command buffer and begin copy pass
     SDL_GPUCommandBuffer *cmdBuf = SDL_AcquireGPUCommandBuffer(context->device);
     SDL_GPUCopyPass *copyPass = SDL_BeginGPUCopyPass(cmdBuf);
@@ -165,19 +215,6 @@ update_buffers(Context *context,
                           },
                           false);
     
-    // Upload index data
-    SDL_UploadToGPUBuffer(copyPass,
-                          &(SDL_GPUTransferBufferLocation)
-                          {
-                              context->transBufInd, 0
-                          },
-                          &(SDL_GPUBufferRegion)
-                          {
-                              context->indexBuf, 0, dataSizeInd
-                          },
-                          false);
-    
-    
     // End pass and submit command buffer
     SDL_EndGPUCopyPass(copyPass);
     SDL_SubmitGPUCommandBuffer(cmdBuf);
@@ -341,6 +378,7 @@ int main(int argc, char *argv[])
     Context context = {0};
     bool quit = false;
     bool minimized = false;
+    bool dirty = true;
     float lastTime = 0;
     
     (void)argc;
@@ -398,7 +436,7 @@ int main(int argc, char *argv[])
     
     create_buffers(&context,
                    sizeof(Vertex) * 4 * maxQuadCount,
-                   sizeof(Uint32) * 6 * maxQuadCount);
+                   maxQuadCount);
     
     // Sampler
     context.sampler = SDL_CreateGPUSampler(context.device,
@@ -435,10 +473,17 @@ int main(int argc, char *argv[])
     
     
     // Update and render loop
+    float lastTouchX = 0;
+    float lastTouchY = 0;
+    
     while (!quit)
     {
-        float lastTouchX;
-        float lastTouchY;
+        // Nothing on screen changes by itself, so block until an event
+        // arrives instead of redrawing the same frame
+        if (minimized || !dirty)
+        {
+            SDL_WaitEventTimeout(NULL, -1);
+        }
         
         // Poll events
         SDL_Event evt;
@@ -452,13 +497,24 @@ int main(int argc, char *argv[])
                 } break;
                 
                 case SDL_EVENT_WINDOW_MINIMIZED:
+                case SDL_EVENT_WILL_ENTER_BACKGROUND:
+                case SDL_EVENT_DID_ENTER_BACKGROUND:
                 {
                     minimized = true;
                 } break;
                 
                 case SDL_EVENT_WINDOW_RESTORED:
+                case SDL_EVENT_DID_ENTER_FOREGROUND:
                 {
                     minimized = false;
+                    dirty = true;
+                } break;
+                
+                case SDL_EVENT_WINDOW_EXPOSED:
+                case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+                {
+                    // The window contents were lost or have to be redrawn
+                    dirty = true;
                 } break;
                 
                 case SDL_EVENT_TERMINATING:
@@ -471,12 +527,14 @@ int main(int argc, char *argv[])
                 {
                     lastTouchX = evt.tfinger.x * winWidth;
                     lastTouchY = evt.tfinger.y * winHeight;
+                    dirty = true;
                 } break;
                 
                 case SDL_EVENT_FINGER_MOTION:
                 {
                     lastTouchX = evt.tfinger.x * winWidth;
                     lastTouchY = evt.tfinger.y * winHeight;
+                    dirty = true;
                 } break;
             }
         }
@@ -484,8 +542,8 @@ int main(int argc, char *argv[])
         // Break out of update and render loop if we just quit
         if (quit) break;
         
-        // If the window is not minimized
-        if (!minimized)
+        // If the window is not minimized and needs redrawing
+        if (!minimized && dirty)
         {
             // Calculate delta time for the frame
             float newTime = SDL_GetTicks() / 1000.0f;
@@ -504,16 +562,7 @@ int main(int argc, char *argv[])
             
             size_t vertexSize = sizeof(vertices);
             
-            // Index data
-            Uint32 indices[] = 
-            {
-                0, 1, 2,
-                2, 3, 0
-            };
-            
-            update_buffers(&context,
-                           vertices, sizeof(vertices),
-                           indices, sizeof(indices));
+            update_buffers(&context, vertices, sizeof(vertices));
             
             
             // Acquire a command buffer to render with
@@ -577,7 +626,7 @@ int main(int argc, char *argv[])
                 
                 SDL_BindGPUIndexBuffer(renderPass,
                                        &(SDL_GPUBufferBinding){ context.indexBuf, 0 },
-                                       SDL_GPU_INDEXELEMENTSIZE_32BIT);
+                                       context.indexElementSize);
                 
                 SDL_DrawGPUIndexedPrimitives(renderPass, 6, 1, 0, 0, 0);
                 
@@ -586,6 +635,7 @@ int main(int argc, char *argv[])
                 
                 // Submit the command buffer
                 SDL_SubmitGPUCommandBuffer(cmdbuf);
+                dirty = false;
             }
             else
             {
@@ -595,11 +645,6 @@ int main(int argc, char *argv[])
                 SDL_CancelGPUCommandBuffer(cmdbuf);
             }
         }
-        else
-        {
-            // Window is minimized, sleep for a frame to avoid high CPU usage
-            SDL_Delay((Uint32)(1000.0f / 60));
-        }
     }
     
     // Clean up resources, even though I think these are not needed anyway
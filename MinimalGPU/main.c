@@ -51,6 +51,7 @@ main(int argc, char **argv)
     Context context = {0};
     bool quit = false;
     bool minimized = false;
+    bool dirty = true;
     float lastTime = 0;
     
     // Init SDL
@@ -120,6 +121,13 @@ main(int argc, char **argv)
     // Update and render loop
     while (!quit)
     {
+        // Nothing on screen changes by itself, so block until an event
+        // arrives instead of redrawing the same frame
+        if (minimized || !dirty)
+        {
+            SDL_WaitEventTimeout(NULL, -1);
+        }
+        
         // Poll events
         SDL_Event evt;
         while (SDL_PollEvent(&evt))
@@ -135,14 +143,21 @@ main(int argc, char **argv)
             else if (evt.type == SDL_EVENT_WINDOW_RESTORED)
             {
                 minimized = false;
+                dirty = true;
+            }
+            else if (evt.type == SDL_EVENT_WINDOW_EXPOSED ||
+                     evt.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED)
+            {
+                // The window contents were lost or have to be redrawn
+                dirty = true;
             }
         }
         
         // Break out of update and render loop if we just quit
         if (quit) break;
         
-        // If the window is not minimized
-        if (!minimized)
+        // If the window is not minimized and needs redrawing
+        if (!minimized && dirty)
         {
             // Calculate delta time for the frame
             float newTime = SDL_GetTicks() / 1000.0f;
@@ -186,6 +201,7 @@ main(int argc, char **argv)
                 
                 // Submit the command buffer
                 SDL_SubmitGPUCommandBuffer(cmdbuf);
+                dirty = false;
             }
             else
             {
@@ -195,11 +211,6 @@ main(int argc, char **argv)
                 SDL_CancelGPUCommandBuffer(cmdbuf);
             }
         }
-        else
-        {
-            // Window is minimized, sleep for a frame to avoid high CPU usage
-            SDL_Delay((Uint32)(1000.0f / 60));
-        }
     }
     
     // Clean up resources, even though I think these are not needed anyway
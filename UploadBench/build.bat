@@ -0,0 +1,13 @@
+@echo off
+
+set sdli=-IW:\libs\sdl\3.2.8\include
+set sdll=-LIBPATH:W:\libs\sdl\3.2.8\lib\x64
+
+IF NOT EXIST bin mkdir bin
+
+pushd bin
+
+REM Console subsystem, the results are printed as a table
+cl -FC -EHsc -MT -nologo -Z7 %sdli% ../main.c -link %sdll% -SUBSYSTEM:CONSOLE SDL3.lib
+
+popd
@@ -0,0 +1,342 @@
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_main.h>
+#include <assert.h>
+
+// Measures the ways the samples move data into GPU buffers. Every upload
+// is a payload split in half, vertices and indices, like a mesh update.
+//
+// Usage: main [--max-size-mb N] [--csv path]
+
+// Payloads go from 1 KB up to this, four times larger each step
+#define MIN_PAYLOAD_SIZE 1024
+#define MAX_PAYLOAD_SIZE (64 * 1024 * 1024)
+
+// Roughly this many bytes are uploaded per measurement, within the limits
+#define BYTES_PER_MEASUREMENT (256 * 1024 * 1024)
+#define MIN_ITERATIONS 16
+#define MAX_ITERATIONS 2000
+#define WARMUP_ITERATIONS 4
+
+// Same as the samples, the CPU may run this many uploads ahead
+#define FRAMES_IN_FLIGHT 2
+
+// Uploads the chunked strategies split the payload into, half each side
+#define CHUNK_COUNT 16
+
+typedef struct
+{
+    const char *name;
+    
+    // Two is AndroidGPU's separate vertex and index transfer buffers, one
+    // is AdvancedGPU's packed RenderBuffers.transfer
+    Uint32 transferCount;
+    
+    // Without cycling, mapping has to wait until the GPU is done with
+    // the previous upload
+    bool cycle;
+    
+    // One transfer buffer with a slice per frame in flight, never cycled
+    bool ring;
+    
+    // Uploads per payload, and whether each gets its own command buffer
+    Uint32 chunkCount;
+    bool submitEach;
+    
+} UploadStrategy;
+
+static const UploadStrategy strategies[] =
+{
+    { "two_transfers",      2, true,  false, 2,           false },
+    { "one_transfer",       1, true,  false, 2,           false },
+    { "one_transfer_wait",  1, false, false, 2,           false },
+    { "ring",               1, false, true,  2,           false },
+    { "chunks_one_submit",  1, true,  false, CHUNK_COUNT, false },
+    { "chunks_submit_each", 1, true,  false, CHUNK_COUNT, true  },
+};
+
+typedef struct
+{
+    Uint32 iterations;
+    
+    // Wall time includes waiting for the GPU to finish the last upload
+    Uint64 wallTime;
+    Uint64 cpuTime;
+    Uint64 waitTime;
+    
+} UploadResult;
+
+typedef struct
+{
+    SDL_GPUDevice* device;
+    
+    // Source data, the largest payload
+    Uint8 *payload;
+    
+    // Uploads the GPU hasn't finished, oldest first
+    SDL_GPUFence *fences[FRAMES_IN_FLIGHT];
+    Uint32 fenceFirst;
+    Uint32 fenceCount;
+    
+} Context;
+
+void
+fences_wait(Context *context,
+            Uint32 maxPending)
+{
+    // Oldest first until no more than maxPending are left
+    while (context->fenceCount > maxPending)
+    {
+        SDL_GPUFence *fence = context->fences[context->fenceFirst];
+        SDL_WaitForGPUFences(context->device, true, &fence, 1);
+        SDL_ReleaseGPUFence(context->device, fence);
+        
+        context->fenceFirst = (context->fenceFirst + 1) % FRAMES_IN_FLIGHT;
+        context->fenceCount--;
+    }
+}
+
+void
+fences_push(Context *context,
+            SDL_GPUFence *fence)
+{
+    assert(fence);
+    assert(context->fenceCount < FRAMES_IN_FLIGHT);
+    
+    Uint32 slot = (context->fenceFirst + context->fenceCount) % FRAMES_IN_FLIGHT;
+    context->fences[slot] = fence;
+    context->fenceCount++;
+}
+
+void
+upload_iteration(Context *context,
+                 const UploadStrategy *strategy,
+                 SDL_GPUTransferBuffer *transfers[],
+                 SDL_GPUBuffer *destinations[],
+                 Uint32 size,
+                 Uint32 iteration)
+{
+    Uint32 half = size / 2;
+    
+    // The ring writes the slice the GPU finished with frames in flight ago
+    Uint32 sliceOffset = strategy->ring ? (iteration % FRAMES_IN_FLIGHT) * size : 0;
+    
+    // Fill the transfer buffers, one map per buffer
+    if (strategy->transferCount == 2)
+    {
+        for (Uint32 t = 0; t < 2; ++t)
+        {
+            Uint8 *data = SDL_MapGPUTransferBuffer(context->device, transfers[t], strategy->cycle);
+            SDL_memcpy(data, context->payload + t * half, half);
+            SDL_UnmapGPUTransferBuffer(context->device, transfers[t]);
+        }
+    }
+    else
+    {
+        Uint8 *data = SDL_MapGPUTransferBuffer(context->device, transfers[0], strategy->cycle);
+        SDL_memcpy(data + sliceOffset, context->payload, size);
+        SDL_UnmapGPUTransferBuffer(context->device, transfers[0]);
+    }
+    
+    // Record the uploads, the first half of the chunks go to the vertex
+    // buffer and the rest to the index buffer
+    Uint32 chunkSize = size / strategy->chunkCount;
+    Uint32 chunksPerHalf = strategy->chunkCount / 2;
+    SDL_GPUCommandBuffer *cmdbuf = 0;
+    SDL_GPUCopyPass *copyPass = 0;
+    
+    for (Uint32 chunk = 0; chunk < strategy->chunkCount; ++chunk)
+    {
+        Uint32 side = chunk / chunksPerHalf;
+        Uint32 destinationOffset = (chunk % chunksPerHalf) * chunkSize;
+        
+        SDL_GPUTransferBufferLocation source = (strategy->transferCount == 2) ?
+            (SDL_GPUTransferBufferLocation){ transfers[side], destinationOffset } :
+            (SDL_GPUTransferBufferLocation){ transfers[0], sliceOffset + chunk * chunkSize };
+        
+        if (!cmdbuf)
+        {
+            cmdbuf = SDL_AcquireGPUCommandBuffer(context->device);
+            assert(cmdbuf);
+            copyPass = SDL_BeginGPUCopyPass(cmdbuf);
+        }
+        
+        // Cycle only on the first chunk per destination. Later chunks
+        // would otherwise throw away the ones uploaded before them.
+        SDL_UploadToGPUBuffer(copyPass,
+                              &source,
+                              &(SDL_GPUBufferRegion)
+                              {
+                                  destinations[side],
+                                  destinationOffset,
+                                  chunkSize
+                              },
+                              strategy->cycle && destinationOffset == 0);
+        
+        // Only the last submit gets a fence, the queue runs in order
+        bool last = (chunk == strategy->chunkCount - 1);
+        if (strategy->submitEach || last)
+        {
+            SDL_EndGPUCopyPass(copyPass);
+            if (last)
+            {
+                fences_push(context, SDL_SubmitGPUCommandBufferAndAcquireFence(cmdbuf));
+            }
+            else
+            {
+                SDL_SubmitGPUCommandBuffer(cmdbuf);
+            }
+            cmdbuf = 0;
+        }
+    }
+}
+
+UploadResult
+upload_measure(Context *context,
+               const UploadStrategy *strategy,
+               Uint32 size)
+{
+    UploadResult result = {0};
+    result.iterations = SDL_clamp(BYTES_PER_MEASUREMENT / size, MIN_ITERATIONS, MAX_ITERATIONS);
+    
+    Uint32 half = size / 2;
+    Uint32 transferSize = (strategy->transferCount == 2) ? half :
+        (strategy->ring ? size * FRAMES_IN_FLIGHT : size);
+    
+    SDL_GPUTransferBuffer *transfers[2] = {0};
+    for (Uint32 t = 0; t < strategy->transferCount; ++t)
+    {
+        transfers[t] =
+            SDL_CreateGPUTransferBuffer(context->device,
+                                        &(SDL_GPUTransferBufferCreateInfo)
+                                        {
+                                            SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                                            transferSize
+                                        });
+        assert(transfers[t]);
+    }
+    
+    SDL_GPUBuffer *destinations[2] =
+    {
+        SDL_CreateGPUBuffer(context->device,
+                            &(SDL_GPUBufferCreateInfo){ SDL_GPU_BUFFERUSAGE_VERTEX, half, 0 }),
+        SDL_CreateGPUBuffer(context->device,
+                            &(SDL_GPUBufferCreateInfo){ SDL_GPU_BUFFERUSAGE_INDEX, half, 0 }),
+    };
+    assert(destinations[0] && destinations[1]);
+    
+    // Not measured, the first uploads allocate behind the scenes
+    Uint32 totalIterations = WARMUP_ITERATIONS + result.iterations;
+    Uint64 startTime = 0;
+    for (Uint32 iteration = 0; iteration < totalIterations; ++iteration)
+    {
+        if (iteration == WARMUP_ITERATIONS)
+        {
+            fences_wait(context, 0);
+            startTime = SDL_GetTicksNS();
+            result.waitTime = 0;
+            result.cpuTime = 0;
+        }
+        
+        // Waiting on the GPU is counted apart from the CPU work. Without
+        // cycling nothing else makes the map safe.
+        Uint64 waitStart = SDL_GetTicksNS();
+        fences_wait(context, (strategy->cycle || strategy->ring) ? FRAMES_IN_FLIGHT - 1 : 0);
+        Uint64 cpuStart = SDL_GetTicksNS();
+        
+        upload_iteration(context, strategy, transfers, destinations, size, iteration);
+        
+        Uint64 cpuEnd = SDL_GetTicksNS();
+        result.waitTime += cpuStart - waitStart;
+        result.cpuTime += cpuEnd - cpuStart;
+    }
+    
+    fences_wait(context, 0);
+    result.wallTime = SDL_GetTicksNS() - startTime;
+    
+    for (Uint32 t = 0; t < strategy->transferCount; ++t)
+    {
+        SDL_ReleaseGPUTransferBuffer(context->device, transfers[t]);
+    }
+    SDL_ReleaseGPUBuffer(context->device, destinations[0]);
+    SDL_ReleaseGPUBuffer(context->device, destinations[1]);
+    
+    return result;
+}
+
+// Main entry point
+int
+main(int argc, char **argv)
+{
+    Context context = {0};
+    Uint32 maxSize = MAX_PAYLOAD_SIZE;
+    const char *csvPath = "upload_bench.csv";
+    
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], "--max-size-mb") == 0)
+        {
+            maxSize = SDL_clamp(SDL_atoi(argv[i + 1]), 1, MAX_PAYLOAD_SIZE / (1024 * 1024)) * 1024 * 1024;
+        }
+        else if (SDL_strcmp(argv[i], "--csv") == 0)
+        {
+            csvPath = argv[i + 1];
+        }
+    }
+    
+    // No window, so don't ask for a display. SDL_VIDEO_DRIVER in the
+    // environment still wins.
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+    assert(SDL_Init(SDL_INIT_VIDEO));
+    
+    // Create GPU Device
+    context.device = SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV,
+                                         false, 0);
+    assert(context.device);
+    
+    // Something that isn't all zeroes
+    context.payload = SDL_malloc(maxSize);
+    assert(context.payload);
+    for (Uint32 i = 0; i < maxSize; ++i)
+    {
+        context.payload[i] = (Uint8)(i * 31 + (i >> 8));
+    }
+    
+    SDL_IOStream *csv = SDL_IOFromFile(csvPath, "w");
+    assert(csv);
+    SDL_IOprintf(csv, "strategy,size_bytes,iterations,mb_per_sec,cpu_us_per_upload,wait_us_per_upload\n");
+    
+    SDL_Log("Upload strategies on %s", SDL_GetGPUDeviceDriver(context.device));
+    SDL_Log("%-20s %10s %6s %10s %10s %10s",
+            "strategy", "size", "iters", "MB/s", "cpu us", "wait us");
+    
+    for (Uint32 s = 0; s < SDL_arraysize(strategies); ++s)
+    {
+        const UploadStrategy *strategy = strategies + s;
+        for (Uint32 size = MIN_PAYLOAD_SIZE; size <= maxSize; size *= 4)
+        {
+            UploadResult result = upload_measure(&context, strategy, size);
+            
+            double seconds = result.wallTime / 1e9;
+            double megabytesPerSecond =
+                (double)size * result.iterations / (1024.0 * 1024.0) / seconds;
+            double cpuMicroseconds = result.cpuTime / 1000.0 / result.iterations;
+            double waitMicroseconds = result.waitTime / 1000.0 / result.iterations;
+            
+            SDL_Log("%-20s %10u %6u %10.1f %10.2f %10.2f",
+                    strategy->name, size, result.iterations,
+                    megabytesPerSecond, cpuMicroseconds, waitMicroseconds);
+            SDL_IOprintf(csv, "%s,%u,%u,%.2f,%.3f,%.3f\n",
+                         strategy->name, size, result.iterations,
+                         megabytesPerSecond, cpuMicroseconds, waitMicroseconds);
+        }
+    }
+    
+    SDL_CloseIO(csv);
+    SDL_Log("Results written to %s", csvPath);
+    
+    SDL_free(context.payload);
+    SDL_DestroyGPUDevice(context.device);
+    SDL_Quit();
+    
+    return 0;
+}